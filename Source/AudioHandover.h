@@ -0,0 +1,81 @@
+/*
+  ==============================================================================
+
+    AudioHandover.h
+
+    Xenos: Xenharmonic Stochastic Synthesizer
+    Raphael Radna
+    This code is licensed under the GPLv3
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <juce_core/juce_core.h>
+#include <atomic>
+#include <memory>
+#include "choc_SingleReaderSingleWriterFIFO.h"
+
+// Hands immutable objects built on the message thread to the audio thread, and back again when
+// they're replaced, so that the audio thread neither allocates nor frees them and never sees one
+// being destroyed.
+//
+// publish() may be called any number of times between two blocks. Only the latest object
+// reaches the audio thread, the ones it never took are destroyed right away. The audio thread
+// takes the latest with acquire() at the start of a block and retires the one it replaces,
+// after which it mustn't use the old one any more. The retired objects are destroyed on the
+// message thread by the next publish() or collectRetired().
+template <typename T> class AudioHandover
+{
+  public:
+    explicit AudioHandover(std::unique_ptr<T> initial) : current(initial.release())
+    {
+        retired.reset(capacity);
+    }
+    ~AudioHandover()
+    {
+        collectRetired();
+        delete pending.exchange(nullptr);
+        delete current;
+    }
+
+    // Message thread
+    void publish(std::unique_ptr<T> object)
+    {
+        collectRetired();
+        delete pending.exchange(object.release(), std::memory_order_acq_rel);
+    }
+    void collectRetired()
+    {
+        T *object = nullptr;
+        while (retired.pop(object))
+            delete object;
+    }
+
+    // Audio thread, at the start of a block. Returns the newly published object, or null if
+    // there's none, and makes it the current one.
+    const T *acquire()
+    {
+        auto *object = pending.exchange(nullptr, std::memory_order_acq_rel);
+        if (!object)
+            return nullptr;
+        // Every retirement follows a publish, which empties the FIFO first, so it can't fill
+        // up. If it somehow did, the old object is leaked rather than freed here.
+        const bool retiredInTime = retired.push(current);
+        jassert(retiredInTime);
+        juce::ignoreUnused(retiredInTime);
+        current = object;
+        return current;
+    }
+    // Audio thread, or any thread while the audio thread isn't running
+    const T &getCurrent() const { return *current; }
+
+  private:
+    static constexpr int capacity = 16;
+    std::atomic<T *> pending{nullptr};
+    T *current;
+    choc::fifo::SingleReaderSingleWriterFIFO<T *> retired;
+
+    JUCE_DECLARE_NON_COPYABLE(AudioHandover)
+};
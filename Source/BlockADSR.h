@@ -0,0 +1,208 @@
+/*
+  ==============================================================================
+
+    BlockADSR.h
+
+    Xenos: Xenharmonic Stochastic Synthesizer
+    Raphael Radna
+    This code is licensed under the GPLv3
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+
+// A linear ADSR with the same shape and parameters as juce::ADSR, but computed a block at a time.
+// Each stage is a straight segment whose length in samples is known when the stage starts, so
+// a block is filled with at most a few ramps instead of stepping the state machine per sample.
+// The ramps have no loop-carried dependency and vectorise.
+//
+// During the sustain plateau and when idle nothing is written at all, process() tells the
+// caller so that it can apply the level as a plain gain or skip the voice.
+class BlockADSR
+{
+  public:
+    struct Parameters
+    {
+        Parameters() = default;
+        Parameters(float attackTimeSeconds, float decayTimeSeconds, float sustainLevel,
+                   float releaseTimeSeconds)
+            : attack(attackTimeSeconds), decay(decayTimeSeconds), sustain(sustainLevel),
+              release(releaseTimeSeconds)
+        {
+        }
+
+        float attack = 0.1f, decay = 0.1f, sustain = 1.0f, release = 0.1f;
+    };
+
+    enum class Stage
+    {
+        idle,
+        attack,
+        decay,
+        sustain,
+        release
+    };
+
+    enum class BlockKind
+    {
+        Idle,     // silent for the whole block, nothing written
+        Constant, // getLevel() for the whole block, nothing written
+        Ramp      // the levels were written to the output
+    };
+
+    void setSampleRate(double newSampleRate)
+    {
+        jassert(newSampleRate > 0.0);
+        sampleRate = newSampleRate;
+        updateCurrentStage();
+    }
+
+    void setParameters(const Parameters &newParameters)
+    {
+        jassert(newParameters.attack >= 0.0f && newParameters.decay >= 0.0f &&
+                newParameters.release >= 0.0f);
+        parameters = newParameters;
+        parameters.sustain = juce::jlimit(0.0f, 1.0f, parameters.sustain);
+        updateCurrentStage();
+    }
+
+    void noteOn() { enterStage(Stage::attack); }
+
+    void noteOff()
+    {
+        if (stage != Stage::idle)
+            enterStage(Stage::release);
+    }
+
+    void reset()
+    {
+        level = 0.0f;
+        stage = Stage::idle;
+        samplesLeft = 0;
+    }
+
+    bool isActive() const { return stage != Stage::idle; }
+    Stage getStage() const { return stage; }
+    // the level after the last processed sample
+    float getLevel() const { return level; }
+
+    // Advances the envelope by numSamples. Only writes to out when returning Ramp, then all
+    // numSamples values are written.
+    BlockKind process(float *out, int numSamples)
+    {
+        if (stage == Stage::idle)
+            return BlockKind::Idle;
+        if (stage == Stage::sustain)
+            return BlockKind::Constant;
+        int i = 0;
+        while (i < numSamples)
+        {
+            if (stage == Stage::idle || stage == Stage::sustain)
+            {
+                juce::FloatVectorOperations::fill(out + i, level, numSamples - i);
+                break;
+            }
+            const int n = std::min(numSamples - i, samplesLeft);
+            const float start = level;
+            float *dest = out + i;
+            for (int k = 0; k < n; ++k)
+                dest[k] = start + step * (float)(k + 1);
+            i += n;
+            samplesLeft -= n;
+            if (samplesLeft == 0)
+            {
+                // land exactly on the target, whatever the rounding along the way
+                level = target;
+                out[i - 1] = level;
+                enterStage(nextStage());
+            }
+            else
+            {
+                level = start + step * (float)n;
+            }
+        }
+        return BlockKind::Ramp;
+    }
+
+  private:
+    Stage nextStage() const
+    {
+        switch (stage)
+        {
+        case Stage::attack:
+            return Stage::decay;
+        case Stage::decay:
+            return Stage::sustain;
+        case Stage::release:
+            return Stage::idle;
+        default:
+            return stage;
+        }
+    }
+
+    // The segment lengths follow juce::ADSR: the attack rises at the rate for going from 0 to 1
+    // in the attack time, the decay falls at the rate for going from 1 to the sustain level in
+    // the decay time, and the release always takes the release time from wherever it starts.
+    void enterStage(Stage newStage)
+    {
+        for (;;)
+        {
+            stage = newStage;
+            double lengthInSamples = 0.0;
+            switch (stage)
+            {
+            case Stage::idle:
+                reset();
+                return;
+            case Stage::sustain:
+                level = parameters.sustain;
+                return;
+            case Stage::attack:
+                target = 1.0f;
+                lengthInSamples = (1.0f - level) * parameters.attack * sampleRate;
+                break;
+            case Stage::decay:
+                target = parameters.sustain;
+                if (parameters.sustain < 1.0f)
+                    lengthInSamples = (level - parameters.sustain) / (1.0f - parameters.sustain) *
+                                      parameters.decay * sampleRate;
+                break;
+            case Stage::release:
+                target = 0.0f;
+                lengthInSamples = parameters.release * sampleRate;
+                break;
+            }
+            samplesLeft = (int)std::ceil(lengthInSamples - 1.0e-3);
+            if (samplesLeft > 0)
+            {
+                step = (target - level) / (float)samplesLeft;
+                return;
+            }
+            level = target;
+            newStage = nextStage();
+        }
+    }
+
+    // replans the stage in progress after the parameters or the sample rate changed
+    void updateCurrentStage()
+    {
+        if (stage == Stage::release)
+        {
+            // like juce::ADSR, which keeps the release rate until the next note off
+            return;
+        }
+        if (stage != Stage::idle)
+            enterStage(stage);
+    }
+
+    Parameters parameters;
+    double sampleRate = 44100.0;
+    Stage stage = Stage::idle;
+    float level = 0.0f;
+    float target = 0.0f;
+    float step = 0.0f;
+    int samplesLeft = 0;
+};
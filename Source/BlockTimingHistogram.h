@@ -0,0 +1,163 @@
+/*
+  ==============================================================================
+
+    BlockTimingHistogram.h
+
+    Xenos: Xenharmonic Stochastic Synthesizer
+    Raphael Radna
+    This code is licensed under the GPLv3
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <juce_core/juce_core.h>
+#include <array>
+#include <atomic>
+#include <cmath>
+
+// How long the audio callbacks take, as a histogram instead of an average, so that the rare
+// slow blocks that cause dropouts show up. The audio thread is the only writer. Any thread
+// may read a Report while it runs, each counter is read atomically, but a report taken during
+// a block may be off by that block.
+//
+// The buckets are spaced logarithmically, bucketsPerOctave to a doubling, from 1 us to about
+// 4 s, so the percentiles are within 9% of the true value.
+class BlockTimingHistogram
+{
+  public:
+    struct Report
+    {
+        // in milliseconds
+        double p50 = 0.0, p99 = 0.0, p999 = 0.0, max = 0.0;
+        // the time available for the last block
+        double deadline = 0.0;
+        juce::int64 numBlocks = 0;
+        // blocks that took longer than their duration
+        juce::int64 deadlineMisses = 0;
+        int blockSize = 0;
+
+        juce::String toString() const
+        {
+            juce::String result;
+            result << "Block time p50 " << juce::String(p50, 2) << " ms, p99 "
+                   << juce::String(p99, 2) << " ms, p99.9 " << juce::String(p999, 2)
+                   << " ms, max " << juce::String(max, 2) << " ms\n"
+                   << deadlineMisses << " of " << numBlocks << " blocks over "
+                   << juce::String(deadline, 2) << " ms (" << blockSize << " samples)";
+            return result;
+        }
+    };
+
+    void prepare(double newSampleRate) { sampleRate.store(newSampleRate); }
+
+    // May be called from any thread, the audio thread clears the counters at its next block
+    void reset() { resetRequested.store(true); }
+
+    // Audio thread: times the callback it's created in
+    class ScopedTimer
+    {
+      public:
+        ScopedTimer(BlockTimingHistogram &h, int numSamples)
+            : histogram(h), blockSize(numSamples), start(juce::Time::getHighResolutionTicks())
+        {
+        }
+        ~ScopedTimer()
+        {
+            const auto ticks = juce::Time::getHighResolutionTicks() - start;
+            histogram.addBlock(juce::Time::highResolutionTicksToSeconds(ticks), blockSize);
+        }
+
+      private:
+        BlockTimingHistogram &histogram;
+        int blockSize;
+        juce::int64 start;
+    };
+
+    void addBlock(double seconds, int numSamples)
+    {
+        if (resetRequested.exchange(false))
+        {
+            for (auto &c : counts)
+                c.store(0, std::memory_order_relaxed);
+            maxSeconds.store(0.0, std::memory_order_relaxed);
+            numBlocks.store(0, std::memory_order_relaxed);
+            deadlineMisses.store(0, std::memory_order_relaxed);
+        }
+        increment(counts[getBucket(seconds)]);
+        increment(numBlocks);
+        if (seconds * sampleRate.load(std::memory_order_relaxed) > numSamples)
+            increment(deadlineMisses);
+        if (seconds > maxSeconds.load(std::memory_order_relaxed))
+            maxSeconds.store(seconds, std::memory_order_relaxed);
+        blockSize.store(numSamples, std::memory_order_relaxed);
+    }
+
+    Report getReport() const
+    {
+        std::array<juce::int64, numBuckets> snapshot;
+        juce::int64 total = 0;
+        for (int i = 0; i < numBuckets; ++i)
+        {
+            snapshot[i] = counts[i].load(std::memory_order_relaxed);
+            total += snapshot[i];
+        }
+        Report r;
+        r.p50 = getPercentile(snapshot, total, 0.5);
+        r.p99 = getPercentile(snapshot, total, 0.99);
+        r.p999 = getPercentile(snapshot, total, 0.999);
+        r.max = maxSeconds.load(std::memory_order_relaxed) * 1000.0;
+        r.numBlocks = numBlocks.load(std::memory_order_relaxed);
+        r.deadlineMisses = deadlineMisses.load(std::memory_order_relaxed);
+        r.blockSize = blockSize.load(std::memory_order_relaxed);
+        r.deadline = r.blockSize * 1000.0 / sampleRate.load(std::memory_order_relaxed);
+        return r;
+    }
+
+  private:
+    static constexpr int bucketsPerOctave = 8;
+    static constexpr int numOctaves = 22;
+    static constexpr int numBuckets = bucketsPerOctave * numOctaves;
+    static constexpr double minSeconds = 1.0e-6;
+
+    static int getBucket(double seconds)
+    {
+        if (seconds <= minSeconds)
+            return 0;
+        const int bucket = (int)(std::log2(seconds / minSeconds) * bucketsPerOctave);
+        return juce::jmin(bucket, numBuckets - 1);
+    }
+    // the upper edge of the bucket, in milliseconds
+    static double getBucketLimit(int bucket)
+    {
+        return minSeconds * std::exp2((bucket + 1) / (double)bucketsPerOctave) * 1000.0;
+    }
+    static double getPercentile(const std::array<juce::int64, numBuckets> &snapshot,
+                                juce::int64 total, double proportion)
+    {
+        if (total == 0)
+            return 0.0;
+        const auto target = (juce::int64)std::ceil(total * proportion);
+        juce::int64 sum = 0;
+        for (int i = 0; i < numBuckets; ++i)
+        {
+            sum += snapshot[i];
+            if (sum >= target)
+                return getBucketLimit(i);
+        }
+        return getBucketLimit(numBuckets - 1);
+    }
+    // only the audio thread writes, so this needs no read-modify-write
+    template <typename T> static void increment(std::atomic<T> &counter)
+    {
+        counter.store(counter.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+
+    std::array<std::atomic<juce::int64>, numBuckets> counts{};
+    std::atomic<double> maxSeconds{0.0};
+    std::atomic<juce::int64> numBlocks{0}, deadlineMisses{0};
+    std::atomic<int> blockSize{0};
+    std::atomic<double> sampleRate{44100.0};
+    std::atomic<bool> resetRequested{false};
+};
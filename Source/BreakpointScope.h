@@ -0,0 +1,74 @@
+/*
+  ==============================================================================
+
+    BreakpointScope.h
+
+    Xenos: Xenharmonic Stochastic Synthesizer
+    Raphael Radna
+    This code is licensed under the GPLv3
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <atomic>
+#include "choc_SingleReaderSingleWriterFIFO.h"
+
+// One cycle of a voice's waveform as breakpoints: the relative segment lengths from the pitch
+// walk and the amplitudes at the segment starts from the amplitude walk
+struct BreakpointSnapshot
+{
+    static constexpr int maxPoints = 128;
+    int voiceId = -1;
+    int note = -1;
+    int numPoints = 0;
+    float durations[maxPoints];
+    float amplitudes[maxPoints];
+};
+
+// Carries breakpoint snapshots from the audio thread to the editor's scope through a single
+// writer FIFO. Nothing is published unless a scope is showing, and then only for voices whose
+// cycle wrapped, at most updateHz times a second.
+class BreakpointScopeFeed
+{
+  public:
+    enum class Selection
+    {
+        allVoices,
+        newestVoice
+    };
+
+    BreakpointScopeFeed() { fifo.reset(capacity); }
+
+    void prepare(double sampleRate) { samplesPerUpdate = (int)(sampleRate / updateHz); }
+
+    // GUI thread
+    void setEnabled(bool shouldBeEnabled) { enabled.store(shouldBeEnabled); }
+    void setSelection(Selection s) { selection.store(s); }
+    Selection getSelection() const { return selection.load(); }
+    bool pop(BreakpointSnapshot &snapshot) { return fifo.pop(snapshot); }
+
+    // Audio thread, once per block: whether snapshots are due after this block
+    bool isDue(int numSamples)
+    {
+        if (!enabled.load(std::memory_order_relaxed))
+            return false;
+        samplesUntilDue -= numSamples;
+        if (samplesUntilDue > 0)
+            return false;
+        samplesUntilDue = samplesPerUpdate;
+        return true;
+    }
+    // false when the FIFO is full, the GUI hasn't caught up yet
+    bool push(const BreakpointSnapshot &snapshot) { return fifo.push(snapshot); }
+
+  private:
+    static constexpr int capacity = 128;
+    static constexpr double updateHz = 30.0;
+    choc::fifo::SingleReaderSingleWriterFIFO<BreakpointSnapshot> fifo;
+    std::atomic<bool> enabled{false};
+    std::atomic<Selection> selection{Selection::allVoices};
+    int samplesPerUpdate = 1470;
+    int samplesUntilDue = 0;
+};
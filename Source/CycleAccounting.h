@@ -0,0 +1,119 @@
+/*
+  ==============================================================================
+
+    CycleAccounting.h
+
+    Xenos: Xenharmonic Stochastic Synthesizer
+    Raphael Radna
+    This code is licensed under the GPLv3
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <juce_core/juce_core.h>
+#include <array>
+#include <atomic>
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#define XENOS_HAS_RDTSC 1
+#elif defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define XENOS_HAS_RDTSC 1
+#endif
+
+// The CPU's time stamp counter on x86. Elsewhere the high resolution clock stands in, so the
+// counts are only comparable with each other.
+inline juce::int64 readCycleCounter()
+{
+#if XENOS_HAS_RDTSC
+    return (juce::int64)__rdtsc();
+#else
+    return juce::Time::getHighResolutionTicks();
+#endif
+}
+
+// Adds the cycles since the previous lap to a counter. A stopwatch made disabled doesn't read
+// the counter at all.
+class CycleStopwatch
+{
+  public:
+    explicit CycleStopwatch(bool enabled) : running(enabled), last(enabled ? readCycleCounter() : 0)
+    {
+    }
+    void lap(juce::int64 &counter)
+    {
+        if (!running)
+            return;
+        const auto now = readCycleCounter();
+        counter += now - last;
+        last = now;
+    }
+
+  private:
+    bool running;
+    juce::int64 last;
+};
+
+// Where the audio thread's cycles go, per slot (a voice or a stream) and per stage of its
+// processing. The slots count into plain counters of their own while they render and the audio
+// thread adds them here once per block, which makes it the only writer. The totals only grow,
+// a reader takes a Snapshot now and then and the difference between two gives the cycles per
+// sample over the time in between. Counting is off until a reader enables it, the editors do
+// while their heat maps are showing.
+template <int numSlots, int numStages> class CycleAccounting
+{
+  public:
+    using Counts = std::array<juce::int64, numStages>;
+    struct Snapshot
+    {
+        std::array<Counts, numSlots> cycles{};
+        std::array<int, numSlots> tags{};
+        // the samples rendered while counting
+        juce::int64 numSamples = 0;
+    };
+
+    // any thread
+    void setEnabled(bool shouldBeEnabled) { enabled.store(shouldBeEnabled); }
+    bool isEnabled() const { return enabled.load(std::memory_order_relaxed); }
+
+    // Audio thread: a slot's counts from the block, which the caller then clears
+    void add(int slot, const Counts &counts)
+    {
+        jassert(slot >= 0 && slot < numSlots);
+        for (int i = 0; i < numStages; ++i)
+            if (counts[i] != 0)
+                increase(totals[slot][i], counts[i]);
+    }
+    // Audio thread: what a slot stands for at the moment, like the cell of a stream, for the
+    // readers to show its counts by. Set with the counts, so a snapshot has them together.
+    void setTag(int slot, int tag) { tags[slot].store(tag, std::memory_order_relaxed); }
+    // Audio thread, after the slots of a block were added
+    void endBlock(int numSamplesInBlock) { increase(numSamples, (juce::int64)numSamplesInBlock); }
+
+    // Any thread. A snapshot taken during a block may be off by that block.
+    void read(Snapshot &snapshot) const
+    {
+        snapshot.numSamples = numSamples.load(std::memory_order_relaxed);
+        for (int s = 0; s < numSlots; ++s)
+        {
+            for (int i = 0; i < numStages; ++i)
+                snapshot.cycles[s][i] = totals[s][i].load(std::memory_order_relaxed);
+            snapshot.tags[s] = tags[s].load(std::memory_order_relaxed);
+        }
+    }
+
+  private:
+    // only the audio thread writes, so this needs no read-modify-write
+    static void increase(std::atomic<juce::int64> &counter, juce::int64 amount)
+    {
+        counter.store(counter.load(std::memory_order_relaxed) + amount,
+                      std::memory_order_relaxed);
+    }
+
+    std::array<std::array<std::atomic<juce::int64>, numStages>, numSlots> totals{};
+    std::array<std::atomic<int>, numSlots> tags{};
+    std::atomic<juce::int64> numSamples{0};
+    std::atomic<bool> enabled{false};
+};
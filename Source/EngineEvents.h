@@ -0,0 +1,113 @@
+/*
+  ==============================================================================
+
+    EngineEvents.h
+
+    Xenos: Xenharmonic Stochastic Synthesizer
+    Raphael Radna
+    This code is licensed under the GPLv3
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <juce_audio_basics/juce_audio_basics.h>
+
+// A MIDI message or a parameter change at a sample position within the current block
+struct EngineEvent
+{
+    enum class Type : uint8_t
+    {
+        Midi,
+        Parameter
+    };
+
+    int sampleOffset = 0;
+    Type type = Type::Midi;
+    uint8_t numMidiBytes = 0;
+    uint8_t midiBytes[3] = {0, 0, 0};
+    int paramIndex = -1;
+    float value = 0.0f;
+
+    juce::MidiMessage getMidiMessage() const { return juce::MidiMessage(midiBytes, numMidiBytes); }
+};
+
+// The events of one block in time order, events at the same position in the order they were
+// added. The storage is reserved up front, adding events never allocates, and events past the
+// capacity are dropped.
+//
+// process() renders the block in runs between the events, so everything is sample accurate
+// while the runs without events can be rendered with the vector code paths.
+class EngineEventList
+{
+  public:
+    explicit EngineEventList(int capacity = 4096) { events.reserve(capacity); }
+
+    void clear() { events.clear(); }
+    int size() const { return (int)events.size(); }
+    bool isEmpty() const { return events.empty(); }
+    const EngineEvent &operator[](int index) const { return events[index]; }
+
+    // Messages longer than 3 bytes, like SysEx, aren't used by the engines and are skipped
+    bool addMidi(int sampleOffset, const uint8_t *data, int numBytes)
+    {
+        if (numBytes <= 0 || numBytes > 3)
+            return false;
+        EngineEvent ev;
+        ev.sampleOffset = sampleOffset;
+        ev.type = EngineEvent::Type::Midi;
+        ev.numMidiBytes = (uint8_t)numBytes;
+        for (int i = 0; i < numBytes; ++i)
+            ev.midiBytes[i] = data[i];
+        return add(ev);
+    }
+
+    bool addParameter(int sampleOffset, int paramIndex, float value)
+    {
+        EngineEvent ev;
+        ev.sampleOffset = sampleOffset;
+        ev.type = EngineEvent::Type::Parameter;
+        ev.paramIndex = paramIndex;
+        ev.value = value;
+        return add(ev);
+    }
+
+    // Calls render(startSample, numSamples) for the runs between the events and handle(event)
+    // for each event, in time order. Events past the end of the block are handled at its end.
+    template <typename RenderFn, typename EventFn>
+    void process(int numSamples, RenderFn &&render, EventFn &&handle) const
+    {
+        int position = 0;
+        for (auto &ev : events)
+        {
+            const int at = juce::jlimit(0, numSamples, ev.sampleOffset);
+            if (at > position)
+            {
+                render(position, at - position);
+                position = at;
+            }
+            handle(ev);
+        }
+        if (position < numSamples)
+            render(position, numSamples - position);
+    }
+
+  private:
+    bool add(const EngineEvent &ev)
+    {
+        if (events.size() == events.capacity())
+        {
+            jassertfalse;
+            return false;
+        }
+        // events mostly arrive in order, so this rarely moves anything
+        auto it = events.end();
+        while (it != events.begin() && (it - 1)->sampleOffset > ev.sampleOffset)
+            --it;
+        events.insert(it, ev);
+        return true;
+    }
+
+    std::vector<EngineEvent> events;
+};
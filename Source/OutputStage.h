@@ -0,0 +1,175 @@
+/*
+  ==============================================================================
+
+    OutputStage.h
+
+    Xenos: Xenharmonic Stochastic Synthesizer
+    Raphael Radna
+    This code is licensed under the GPLv3
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+
+// The master output in one pass over the freshly rendered buffer: the highpass that keeps DC
+// and rumble out, the master gain, an optional soft limiter and flushing denormals to zero.
+//
+// The highpass is the TPT state variable filter of juce::dsp::StateVariableTPTFilter with
+// Butterworth resonance, so the output matches the separate filter pass it replaces. Its
+// recursion runs along time, so the channels of a stereo buffer are computed side by side in
+// the same iteration; the gain, limiter and flush after it are per sample and branch free.
+class OutputStage
+{
+  public:
+    static constexpr int maxChannels = 2;
+
+    void prepare(double newSampleRate)
+    {
+        sampleRate = newSampleRate;
+        cutoff = -1.0f;
+        setCutoffFrequency(16.0f);
+        gain = targetGain;
+        reset();
+    }
+
+    void reset()
+    {
+        for (int ch = 0; ch < maxChannels; ++ch)
+            s1[ch] = s2[ch] = 0.0f;
+    }
+
+    // only recomputes the coefficients when the frequency changed
+    void setCutoffFrequency(float hz)
+    {
+        if (hz == cutoff)
+            return;
+        cutoff = hz;
+        const double pi = 3.14159265358979323846;
+        const double w = std::tan(pi * std::min((double)hz, sampleRate * 0.49) / sampleRate);
+        g = (float)w;
+        h = (float)(1.0 / (1.0 + R2 * w + w * w));
+    }
+
+    // linear gain, ramped to over the next block
+    void setGain(float newGain) { targetGain = newGain; }
+
+    // Above the knee the limiter bends the level smoothly towards the ceiling, below it the
+    // signal passes unchanged
+    void setLimiterEnabled(bool shouldBeEnabled) { limiterEnabled = shouldBeEnabled; }
+
+    // The filter has rung out. Silent input then gives silent output, so a silent block may be
+    // skipped with skipSilentBlock() instead of processed.
+    bool hasDecayed() const
+    {
+        for (int ch = 0; ch < maxChannels; ++ch)
+            if (std::abs(s1[ch]) > decayedLevel || std::abs(s2[ch]) > decayedLevel)
+                return false;
+        return true;
+    }
+
+    void skipSilentBlock()
+    {
+        reset();
+        gain = targetGain;
+    }
+
+    void process(float *const *channels, int numChannels, int numSamples)
+    {
+        numChannels = std::min(numChannels, maxChannels);
+        if (numSamples <= 0 || numChannels <= 0)
+            return;
+        const float gainStep = (targetGain - gain) / (float)numSamples;
+        if (numChannels == 2)
+            processStereo(channels[0], channels[1], numSamples, gainStep);
+        else
+            processMono(channels[0], numSamples, gainStep);
+        gain = targetGain;
+        // the filter state decays towards zero in silence, don't let it become denormal
+        for (int ch = 0; ch < maxChannels; ++ch)
+        {
+            s1[ch] = flush(s1[ch]);
+            s2[ch] = flush(s2[ch]);
+        }
+    }
+
+  private:
+    static float flush(float x) { return std::abs(x) < 1.0e-15f ? 0.0f : x; }
+
+    float limit(float x) const
+    {
+        const float a = std::abs(x);
+        const float over = std::max(a - knee, 0.0f);
+        const float shaped =
+            std::min(a, knee) + over / (1.0f + over * (1.0f / (ceiling - knee)));
+        return std::copysign(shaped, x);
+    }
+
+    float finish(float x, float gainNow) const
+    {
+        float y = x * gainNow;
+        if (limiterEnabled)
+            y = limit(y);
+        return flush(y);
+    }
+
+    void processStereo(float *left, float *right, int numSamples, float gainStep)
+    {
+        float l1 = s1[0], l2 = s2[0], r1 = s1[1], r2 = s2[1];
+        const float gg = g, hh = h, gr = g + (float)R2;
+        for (int i = 0; i < numSamples; ++i)
+        {
+            const float hpL = hh * (left[i] - l1 * gr - l2);
+            const float hpR = hh * (right[i] - r1 * gr - r2);
+            const float bpL = hpL * gg + l1;
+            const float bpR = hpR * gg + r1;
+            l1 = hpL * gg + bpL;
+            r1 = hpR * gg + bpR;
+            const float lpL = bpL * gg + l2;
+            const float lpR = bpR * gg + r2;
+            l2 = bpL * gg + lpL;
+            r2 = bpR * gg + lpR;
+            const float gainNow = gain + gainStep * (float)(i + 1);
+            left[i] = finish(hpL, gainNow);
+            right[i] = finish(hpR, gainNow);
+        }
+        s1[0] = l1;
+        s2[0] = l2;
+        s1[1] = r1;
+        s2[1] = r2;
+    }
+
+    void processMono(float *data, int numSamples, float gainStep)
+    {
+        float z1 = s1[0], z2 = s2[0];
+        const float gg = g, hh = h, gr = g + (float)R2;
+        for (int i = 0; i < numSamples; ++i)
+        {
+            const float hp = hh * (data[i] - z1 * gr - z2);
+            const float bp = hp * gg + z1;
+            z1 = hp * gg + bp;
+            const float lp = bp * gg + z2;
+            z2 = bp * gg + lp;
+            data[i] = finish(hp, gain + gainStep * (float)(i + 1));
+        }
+        s1[0] = z1;
+        s2[0] = z2;
+    }
+
+    // 1 / resonance, with the Butterworth resonance 1 / sqrt(2) the output used before
+    static constexpr double R2 = 1.4142135623730951;
+    static constexpr float knee = 0.7f;
+    static constexpr float ceiling = 1.0f;
+    // -140 dB, well below what a 24 bit output can resolve
+    static constexpr float decayedLevel = 1.0e-7f;
+
+    double sampleRate = 44100.0;
+    float cutoff = -1.0f;
+    float g = 0.0f, h = 1.0f;
+    float gain = 1.0f, targetGain = 1.0f;
+    bool limiterEnabled = false;
+    float s1[maxChannels] = {}, s2[maxChannels] = {};
+};
@@ -12,13 +12,10 @@
 
 #pragma once
 
-#include "ParamListener.h"
-
 struct ParamMenu : juce::ComboBox {
     juce::Label label;
     std::unique_ptr<juce::AudioProcessorValueTreeState::ComboBoxAttachment>
         attachment;
-    ParamListener* listener;
     std::string param, disp;
 
     ParamMenu() {}
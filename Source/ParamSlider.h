@@ -12,13 +12,10 @@
 
 #pragma once
 
-#include "ParamListener.h"
-
 struct ParamSlider : juce::Slider {
     juce::Label label;
     std::unique_ptr<juce::AudioProcessorValueTreeState::SliderAttachment>
         attachment;
-    ParamListener* listener;
     std::string param, disp;
 
     ParamSlider() {}
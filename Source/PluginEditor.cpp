@@ -18,12 +18,17 @@ XenosAudioProcessorEditor::XenosAudioProcessorEditor(XenosAudioProcessor &p,
                                                      juce::AudioProcessorValueTreeState &vts)
     : AudioProcessorEditor(&p), audioProcessor(p), valueTreeState(vts), customButton("load..."),
       keyboardComponent(p.keyboardState, juce::MidiKeyboardComponent::horizontalKeyboard),
-      pitchVisualizer(p.xenosAudioSource.xenosSynth, p.xenosAudioSource.sharedquantizer)
+      pitchVisualizer(p.xenosAudioSource.xenosSynth, p.xenosAudioSource.sharedquantizer),
+      breakpointScope(p.xenosAudioSource.xenosSynth.getScopeFeed()),
+      cpuHeatMap(p.xenosAudioSource.xenosSynth.getCpuStats())
 {
     startTimer(100);
     setSize(700, 560);
     addAndMakeVisible(cpuLoadLabel);
     cpuLoadLabel.setBounds(0, 0, 100, 20);
+    cpuLoadLabel.addMouseListener(this, false);
+    // so that the library is up to date by the time the menu is opened
+    scaleLibrary->refreshAsync();
 
     addAndMakeVisible(pitchVisualizer);
 
@@ -72,6 +77,8 @@ XenosAudioProcessorEditor::XenosAudioProcessorEditor(XenosAudioProcessor &p,
     initParamSlider(mainhpfilter, "mainhpfilterfrequency", "Main highpass filter", horizontal,
                     blue);
     mainhpfilter.setVisible(false);
+    addChildComponent(breakpointScope);
+    addChildComponent(cpuHeatMap);
 
     if (!audioProcessor.customScaleText.isEmpty())
     {
@@ -95,44 +102,108 @@ XenosAudioProcessorEditor::~XenosAudioProcessorEditor() {}
 
 void XenosAudioProcessorEditor::mouseDown(const juce::MouseEvent &ev)
 {
+    if (ev.eventComponent == &cpuLoadLabel)
+    {
+        showPerformanceMenu();
+        return;
+    }
     if (!envelopeLabel.getBounds().contains(ev.getPosition()))
         return;
+    // the panel cycles through its pages: GLOBAL, PAN/FILTER, SCOPE and CPU
+    juce::String page = "GLOBAL";
     if (envelopeLabel.getText() == "GLOBAL")
-    {
-        envelopeLabel.setText("PAN/FILTER", juce::dontSendNotification);
-        attack.setVisible(false);
-        decay.setVisible(false);
-        sustain.setVisible(false);
-        release.setVisible(false);
-        segments.setVisible(false);
-
-        scale.setVisible(false);
-        customButton.setVisible(false);
-        root.setVisible(false);
-        voicepanmode.setVisible(true);
-        mainhpfilter.setVisible(true);
-    }
-    else
-    {
-        envelopeLabel.setText("GLOBAL", juce::dontSendNotification);
-        attack.setVisible(true);
-        decay.setVisible(true);
-        sustain.setVisible(true);
-        release.setVisible(true);
-        segments.setVisible(true);
-
-        scale.setVisible(true);
-        customButton.setVisible(true);
-        root.setVisible(true);
-        voicepanmode.setVisible(false);
-        mainhpfilter.setVisible(false);
-    }
+        page = "PAN/FILTER";
+    else if (envelopeLabel.getText() == "PAN/FILTER")
+        page = "SCOPE";
+    else if (envelopeLabel.getText() == "SCOPE")
+        page = "CPU";
+    envelopeLabel.setText(page, juce::dontSendNotification);
+
+    const bool global = page == "GLOBAL";
+    attack.setVisible(global);
+    decay.setVisible(global);
+    sustain.setVisible(global);
+    release.setVisible(global);
+    segments.setVisible(global);
+
+    scale.setVisible(global);
+    customButton.setVisible(global);
+    root.setVisible(global);
+    voicepanmode.setVisible(page == "PAN/FILTER");
+    mainhpfilter.setVisible(page == "PAN/FILTER");
+    breakpointScope.setVisible(page == "SCOPE");
+    cpuHeatMap.setVisible(page == "CPU");
+}
+
+void XenosAudioProcessorEditor::showPerformanceMenu()
+{
+    juce::PopupMenu menu;
+    menu.addSectionHeader("Polyphony");
+    int polyphony = audioProcessor.getPolyphony();
+    for (int n = 16; n <= MAX_VOICES; n *= 2)
+        menu.addItem(juce::String(n) + " voices", true, polyphony == n,
+                     [this, n]() { audioProcessor.setPolyphony(n); });
+    menu.addSectionHeader("CPU budget");
+    float budget = audioProcessor.getCpuBudget();
+    menu.addItem("No limit", true, budget <= 0.0f, [this]() { audioProcessor.setCpuBudget(0.0f); });
+    for (int percent : {50, 70, 90})
+        menu.addItem(juce::String(percent) + "%", true, juce::roundToInt(budget * 100) == percent,
+                     [this, percent]() { audioProcessor.setCpuBudget(percent / 100.0f); });
+    menu.addSectionHeader("Voice sleep");
+    auto &holder = audioProcessor.xenosAudioSource;
+    float sleepLevel = holder.getVoiceSleepLevel();
+    menu.addItem("Never", true, sleepLevel <= XenosSynthHolder::sleepOffLevel,
+                 [&holder]() { holder.setVoiceSleepLevel(XenosSynthHolder::sleepOffLevel); });
+    for (int decibels : {-120, -96, -80})
+        menu.addItem("Below " + juce::String(decibels) + " dB", true,
+                     juce::roundToInt(sleepLevel) == decibels,
+                     [&holder, decibels]() { holder.setVoiceSleepLevel((float)decibels); });
+    menu.addSectionHeader("Output");
+    float outputGain = audioProcessor.getOutputGain();
+    for (int decibels : {-12, -6, 0, 6})
+        menu.addItem((decibels > 0 ? "+" : "") + juce::String(decibels) + " dB", true,
+                     juce::roundToInt(outputGain) == decibels,
+                     [this, decibels]() { audioProcessor.setOutputGain((float)decibels); });
+    bool limiter = audioProcessor.getOutputLimiter();
+    menu.addItem("Soft limiter", true, limiter,
+                 [this, limiter]() { audioProcessor.setOutputLimiter(!limiter); });
+    menu.addSectionHeader("Block timing");
+    auto timing = audioProcessor.getBlockTimingReport();
+    menu.addItem("p50 " + juce::String(timing.p50, 2) + " ms, p99 " + juce::String(timing.p99, 2) +
+                     " ms",
+                 false, false, []() {});
+    menu.addItem("p99.9 " + juce::String(timing.p999, 2) + " ms, max " +
+                     juce::String(timing.max, 2) + " ms",
+                 false, false, []() {});
+    menu.addItem(juce::String(timing.deadlineMisses) + " late of " +
+                     juce::String(timing.numBlocks) + " blocks (" +
+                     juce::String(timing.blockSize) + " samples)",
+                 false, false, []() {});
+    menu.addItem("Reset", [this]() { audioProcessor.blockTiming.reset(); });
+    menu.addSectionHeader("Voice rendering");
+    int current = audioProcessor.getNumRenderThreads();
+    menu.addItem("Audio thread only", true, current == 1,
+                 [this]() { audioProcessor.setNumRenderThreads(1); });
+    int numCpus = juce::SystemStats::getNumCpus();
+    for (int n = 2; n <= numCpus; n *= 2)
+        menu.addItem(juce::String(n) + " threads", true, current == n,
+                     [this, n]() { audioProcessor.setNumRenderThreads(n); });
+    menu.showMenuAsync(juce::PopupMenu::Options().withTargetComponent(&cpuLoadLabel));
 }
 
 void XenosAudioProcessorEditor::timerCallback()
 {
     juce::String loadTxt(audioProcessor.loadMeasurer.getLoadAsPercentage(), 1);
-    cpuLoadLabel.setText(loadTxt + "% CPU", juce::dontSendNotification);
+    loadTxt << "% CPU";
+    // show when the governor holds the voices below the polyphony
+    int ceiling = audioProcessor.xenosAudioSource.xenosSynth.getVoiceCeiling();
+    if (ceiling < audioProcessor.getPolyphony())
+        loadTxt << " (" << ceiling << ")";
+    cpuLoadLabel.setText(loadTxt, juce::dontSendNotification);
+    // the memory changes with the polyphony and the custom scale, so it's reported afresh
+    cpuLoadLabel.setTooltip(audioProcessor.getBlockTimingReport().toString() + "\n" +
+                            audioProcessor.xenosAudioSource.getMemoryReport().toString() +
+                            "\nClick for polyphony, CPU budget, voice sleep and render threads");
 }
 
 //==============================================================================
@@ -219,6 +290,8 @@ void XenosAudioProcessorEditor::resized()
     customButton.setBounds(panel1X3 + panel1W * 0.75, panel2Y, panel1W * 0.25, menuH);
     root.setBounds(panel1X3, panel2Y + hSliderYOffset, hSliderW, menuH);
     segments.setBounds(panel1X3, panel2Y + hSliderYOffset * 2, hSliderW, menuH);
+    breakpointScope.setBounds(panel1X3, vSliderY, panel1W, segments.getBottom() - vSliderY);
+    cpuHeatMap.setBounds(breakpointScope.getBounds());
 
     auto keyboardY = 13 * h / 16;
     keyboardComponent.setBounds(margin, keyboardY, w - margin * 2, h - keyboardY - margin);
@@ -242,8 +315,6 @@ void XenosAudioProcessorEditor::initParamSlider(ParamSlider &slider, std::string
     slider.disp = d;
 
     slider.attachment.reset(new SliderAttachment(valueTreeState, slider.param, slider));
-    slider.listener = new ParamListener(audioProcessor);
-    valueTreeState.addParameterListener(slider.param, slider.listener);
     slider.setTextValueSuffix(" " + valueTreeState.getParameter(slider.param)->getLabel());
 
     slider.label.setText(slider.disp, juce::dontSendNotification);
@@ -302,8 +373,6 @@ void XenosAudioProcessorEditor::initParamMenu(ParamMenu &menu, std::string p, st
     }
     addAndMakeVisible(menu);
     menu.attachment.reset(new ComboBoxAttachment(valueTreeState, menu.param, menu));
-    menu.listener = new ParamListener(audioProcessor);
-    valueTreeState.addParameterListener(menu.param, menu.listener);
 
     //    menu.label.setText(valueTreeState.getParameter(menu.param)->getName(99),
     //    juce::dontSendNotification);
@@ -324,84 +393,322 @@ void XenosAudioProcessorEditor::initParamMenu(ParamMenu &menu, std::string p, st
 void XenosAudioProcessorEditor::buttonClicked(juce::Button *button)
 {
     if (button == &customButton)
-        loadCustomScale();
+        showCustomScaleMenu();
+}
+
+void XenosAudioProcessorEditor::showCustomScaleMenu()
+{
+    // Shows what the library had at the last scan and rescans in the background, only the
+    // files added or changed since then get parsed
+    const auto entries = scaleLibrary->getEntries();
+    const bool scanning = scaleLibrary->isRefreshing();
+    scaleLibrary->refreshAsync();
+
+    juce::PopupMenu menu;
+    menu.addItem("Load file...", [this]() { loadCustomScale(); });
+
+    juce::PopupMenu libraryMenu;
+    auto addEntry = [this](juce::PopupMenu &m, const ScaleLibrary::Entry &e) {
+        juce::File f = scaleLibrary->getFile(e);
+        juce::String text = e.relativePath.upToLastOccurrenceOf(".", false, false) + " (" +
+                            juce::String(e.numTones) + ")";
+        m.addItem(text, [this, f]() {
+            applyCustomScale(f.loadFileAsString(), f.getFileNameWithoutExtension());
+        });
+    };
+    if (entries->size() <= 64)
+    {
+        for (auto &e : *entries)
+            addEntry(libraryMenu, e);
+    }
+    else
+    {
+        // large libraries are split into submenus by the first character of the path
+        juce::String group;
+        juce::PopupMenu groupMenu;
+        for (auto &e : *entries)
+        {
+            auto first = e.relativePath.substring(0, 1).toUpperCase();
+            if (first != group)
+            {
+                if (group.isNotEmpty())
+                    libraryMenu.addSubMenu(group, groupMenu);
+                groupMenu = juce::PopupMenu();
+                group = first;
+            }
+            addEntry(groupMenu, e);
+        }
+        if (group.isNotEmpty())
+            libraryMenu.addSubMenu(group, groupMenu);
+    }
+    if (entries->empty() && scanning)
+        libraryMenu.addItem("Scanning the library...", false, false, nullptr);
+    else if (entries->empty())
+        libraryMenu.addItem("No scales in " + scaleLibrary->getRootDirectory().getFullPathName(),
+                            false, false, nullptr);
+    libraryMenu.addSeparator();
+    libraryMenu.addItem("Show library folder", [this]() {
+        scaleLibrary->getRootDirectory().createDirectory();
+        scaleLibrary->getRootDirectory().revealToUser();
+    });
+    menu.addSubMenu("Scale library", libraryMenu);
+    menu.showMenuAsync(juce::PopupMenu::Options().withTargetComponent(&customButton));
 }
 
 void XenosAudioProcessorEditor::loadCustomScale()
 {
-    juce::FileChooser chooser("Select a Scala tuning file (.scl) to load.", juce::File{}, "*.scl");
+    juce::FileChooser chooser(
+        "Select a Scala tuning file (.scl) or keyboard mapping (.kbm) to load.", juce::File{},
+        "*.scl;*.kbm");
     if (chooser.browseForFileToOpen())
     {
         juce::File f = chooser.getResult();
-        juce::StringArray scaleData;
-        f.readLines(scaleData);
-        juce::String scaleName = f.getFileNameWithoutExtension();
-        /*
-        if (audioProcessor.xenosAudioSource.loadScl(scaleData, true)) {
-            scale.changeItemText(customScaleMenuIndex, scaleName);
-            scale.setItemEnabled(customScaleMenuIndex, true);
-            scale.setSelectedId(customScaleMenuIndex);
+        if (f.hasFileExtension("kbm"))
+        {
+            auto text = f.loadFileAsString();
+            if (audioProcessor.xenosAudioSource.loadKbmText(text))
+            {
+                audioProcessor.customKbmText = text;
+                audioProcessor.updateHostDisplay();
+            }
+            return;
+        }
+        applyCustomScale(f.loadFileAsString(), f.getFileNameWithoutExtension());
+    }
+}
 
-            audioProcessor.customScaleName = scaleName;
-            audioProcessor.customScaleData = scaleData;
+bool XenosAudioProcessorEditor::applyCustomScale(const juce::String &text,
+                                                 const juce::String &name)
+{
+    // the custom scale is compiled here and handed to the audio thread, selecting it with the
+    // parameter below
+    const bool success = audioProcessor.xenosAudioSource.loadScalaText(text);
+    if (success)
+    {
+        scale.changeItemText(customScaleMenuIndex, name);
+        scale.setItemEnabled(customScaleMenuIndex, true);
+        scale.setSelectedId(customScaleMenuIndex);
 
-            audioProcessor.updateHostDisplay();
-        }
-        */
-        // ok, shouldn't do this but there previously was no synchronization anyway
-        audioProcessor.getCallbackLock().enter();
-        bool success = audioProcessor.xenosAudioSource.loadScala(f);
-        audioProcessor.getCallbackLock().exit();
-        if (success)
-        {
-            scale.changeItemText(customScaleMenuIndex, scaleName);
-            scale.setItemEnabled(customScaleMenuIndex, true);
-            scale.setSelectedId(customScaleMenuIndex);
+        audioProcessor.customScaleName = name;
+        audioProcessor.customScaleText = text;
 
-            audioProcessor.customScaleName = scaleName;
-            audioProcessor.customScaleText =
-                audioProcessor.xenosAudioSource.sharedquantizer.tuning.scale.rawText;
-            // audioProcessor.customScaleData = scaleData;
+        audioProcessor.updateHostDisplay();
+    }
+    return success;
+}
 
-            audioProcessor.updateHostDisplay();
-        }
+void PitchVisualizer::updateTickLayer(float scale, bool external)
+{
+    const int w = juce::roundToInt(getWidth() * scale);
+    const int h = juce::roundToInt(getHeight() / 2 * scale);
+    const unsigned int version = quan.getTuningVersion();
+    const int displayedScale = quan.getDisplayedScale();
+    if (tickLayer.isValid() && tickLayer.getWidth() == w && tickLayer.getHeight() == h &&
+        version == tickLayerVersion && displayedScale == tickLayerScale &&
+        external == tickLayerExternal)
+        return;
+    tickLayerVersion = version;
+    tickLayerScale = displayedScale;
+    tickLayerExternal = external;
+    tickLayer = juce::Image(juce::Image::ARGB, juce::jmax(1, w), juce::jmax(1, h), true);
+    juce::Graphics g(tickLayer);
+    g.addTransform(juce::AffineTransform::scale(scale));
+    g.setColour(external ? juce::Colours::cyan : juce::Colours::white);
+    double minfreq = Tunings::MIDI_0_FREQ * 4;
+    for (int i = 0; i < 128; ++i)
+    {
+        double hz = quan.getHzForMidiNote(i);
+        double pitch = 12.0 * std::log2(hz / minfreq);
+        double xcor = juce::jmap<double>(pitch, 0.0, 100.0, 0.0, getWidth());
+        g.drawLine(xcor, 0, xcor, getHeight() / 2);
     }
 }
 
 void PitchVisualizer::paint(juce::Graphics &g)
 {
-    juce::Colour tickColor;
-    if (quan.mts_client && MTS_HasMaster(quan.mts_client))
-        tickColor = juce::Colours::cyan;
-    else
-        tickColor = juce::Colours::white;
+    const bool external = quan.mts_client && MTS_HasMaster(quan.mts_client);
+    juce::Colour tickColor = external ? juce::Colours::cyan : juce::Colours::white;
     double minfreq = Tunings::MIDI_0_FREQ * 4;
-    for (int i = 0; i < synth.getNumVoices(); ++i)
+    const auto &telemetry = synth.readTelemetry();
+    for (int i = 0; i < telemetry.numVoices; ++i)
     {
-        auto *v = dynamic_cast<XenosVoice *>(synth.getVoice(i));
-        if (v->isVoiceActive())
+        const auto &v = telemetry.voices[i];
+        double pitch = 12.0 * std::log2(v.hz / minfreq);
+        double xcor = juce::jmap<double>(pitch, 0.0, 100.0, 0.0, getWidth());
+        g.setColour(tickColor);
+        g.drawLine(xcor, 0, xcor, getHeight() / 2);
+        xcor = juce::jmap<double>(v.pan, 0.0, 1.0, 0.0, getWidth() - getHeight() / 2);
+        g.setColour(juce::Colours::red.withAlpha(0.5f));
+        g.fillEllipse(xcor, 0, getHeight() / 2, getHeight() / 2);
+    }
+    // the ticks for the currently active tuning, at the display's pixel density
+    const float scale = g.getInternalContext().getPhysicalPixelScaleFactor();
+    updateTickLayer(scale, external);
+    g.drawImage(tickLayer, juce::Rectangle<float>(0.0f, (float)(getHeight() / 2),
+                                                  (float)getWidth(), (float)(getHeight() / 2)));
+}
+
+void BreakpointScope::timerCallback()
+{
+    // snapshots are only published while the scope can be seen
+    feed.setEnabled(isShowing());
+    const auto now = juce::Time::getMillisecondCounter();
+    BreakpointSnapshot snapshot;
+    while (feed.pop(snapshot))
+    {
+        auto &trace = traces[snapshot.voiceId];
+        trace.snapshot = snapshot;
+        trace.updated = now;
+        newestVoice = snapshot.voiceId;
+    }
+    // a voice that stopped publishing has ended or gone to sleep
+    for (auto it = traces.begin(); it != traces.end();)
+    {
+        if (now - it->second.updated > 250)
+            it = traces.erase(it);
+        else
+            ++it;
+    }
+    if (isShowing())
+        repaint();
+}
+
+void BreakpointScope::mouseDown(const juce::MouseEvent &)
+{
+    using Selection = BreakpointScopeFeed::Selection;
+    const bool all = feed.getSelection() == Selection::allVoices;
+    feed.setSelection(all ? Selection::newestVoice : Selection::allVoices);
+    traces.clear();
+    repaint();
+}
+
+void BreakpointScope::paint(juce::Graphics &g)
+{
+    const float w = (float)getWidth();
+    const float h = (float)getHeight();
+    g.setColour(juce::Colours::white.withAlpha(0.25f));
+    g.drawHorizontalLine(getHeight() / 2, 0.0f, w);
+    g.drawRect(getLocalBounds());
+    const bool all = feed.getSelection() == BreakpointScopeFeed::Selection::allVoices;
+    g.setColour(juce::Colours::white);
+    g.setFont(12.0f);
+    g.drawText(all ? "all voices" : "newest voice", getLocalBounds().reduced(4),
+               juce::Justification::topLeft);
+
+    // x follows the segment lengths of the pitch walk, y the amplitude walk, as rendered
+    g.setColour(juce::Colours::lawngreen.withAlpha(all ? 0.4f : 0.9f));
+    for (auto &[voiceId, trace] : traces)
+    {
+        if (!all && voiceId != newestVoice)
+            continue;
+        auto &s = trace.snapshot;
+        float total = 0.0f;
+        for (int i = 0; i < s.numPoints; ++i)
+            total += s.durations[i];
+        if (s.numPoints < 2 || total <= 0.0f)
+            continue;
+        juce::Path path;
+        float x = 0.0f;
+        for (int i = 0; i <= s.numPoints; ++i)
         {
-            // technically, reading the voice variables here in the GUI thread is wrong because they
-            // are not atomic. but it will probably work ok. changing them to atomics would probably
-            // also work ok...
-            double hz = v->xenos.curQuantizedHz;
-            double pitch = 12.0 * std::log2(hz / minfreq);
-            double xcor = juce::jmap<double>(pitch, 0.0, 100.0, 0.0, getWidth());
-            g.setColour(tickColor);
-            g.drawLine(xcor, 0, xcor, getHeight() / 2);
-            float panpos = v->cachedPanPosition;
-            xcor = juce::jmap<double>(panpos, 0.0, 1.0, 0.0, getWidth() - getHeight() / 2);
-            g.setColour(juce::Colours::red.withAlpha(0.5f));
-            g.fillEllipse(xcor, 0, getHeight() / 2, getHeight() / 2);
+            const float y = h * 0.5f * (1.0f - s.amplitudes[i % s.numPoints]);
+            if (i == 0)
+                path.startNewSubPath(0.0f, y);
+            else
+                path.lineTo(w * x / total, y);
+            if (i < s.numPoints)
+                x += s.durations[i];
         }
+        g.strokePath(path, juce::PathStrokeType(1.0f));
     }
-    g.setColour(tickColor);
-    // draw ticks for currently active tuning
-    for (int i = 0; i < 128; ++i)
+}
+
+void VoiceCpuHeatMap::timerCallback()
+{
+    stats.setEnabled(isShowing());
+    if (!isShowing())
     {
-        double hz = quan.getHzForMidiNote(i);
-        double pitch = 12.0 * std::log2(hz / minfreq);
-        double xcor = juce::jmap<double>(pitch, 0.0, 100.0, 0.0, getWidth());
-        g.drawLine(xcor, getHeight() / 2, xcor, getHeight());
+        counting = false;
+        return;
+    }
+    // the first snapshot after the map shows up is only the baseline
+    if (!counting)
+    {
+        stats.read(previous);
+        counting = true;
+        return;
+    }
+    stats.read(current);
+    const auto numSamples = current.numSamples - previous.numSamples;
+    columns.clear();
+    for (int v = 0; v < MAX_VOICES && numSamples > 0; ++v)
+    {
+        Column column;
+        column.voiceId = v;
+        bool rendered = false;
+        for (int i = 0; i < XenosVoice::numCycleStages; ++i)
+        {
+            const auto cycles = current.cycles[v][i] - previous.cycles[v][i];
+            column.cyclesPerSample[i] = (float)cycles / numSamples;
+            rendered = rendered || cycles > 0;
+        }
+        if (rendered)
+            columns.push_back(column);
+    }
+    previous = current;
+    repaint();
+}
+
+// black through red to yellow
+static juce::Colour getHeatColour(float heat)
+{
+    if (heat < 0.5f)
+        return juce::Colours::black.interpolatedWith(juce::Colours::red, heat * 2.0f);
+    return juce::Colours::red.interpolatedWith(juce::Colours::yellow, heat * 2.0f - 1.0f);
+}
+
+void VoiceCpuHeatMap::paint(juce::Graphics &g)
+{
+    static const char *stageNames[XenosVoice::numCycleStages] = {"DSS", "ENV", "PAN"};
+    std::array<float, XenosVoice::numCycleStages> stageTotals{};
+    float hottest = 0.0f;
+    for (auto &c : columns)
+    {
+        for (int i = 0; i < XenosVoice::numCycleStages; ++i)
+        {
+            stageTotals[i] += c.cyclesPerSample[i];
+            hottest = juce::jmax(hottest, c.cyclesPerSample[i]);
+        }
+    }
+    float total = 0.0f;
+    for (auto t : stageTotals)
+        total += t;
+
+    g.setColour(juce::Colours::white.withAlpha(0.25f));
+    g.drawRect(getLocalBounds());
+    auto area = getLocalBounds().reduced(4);
+    g.setColour(juce::Colours::white);
+    g.setFont(12.0f);
+    g.drawText(juce::String(columns.size()) + " voices, " + juce::String(total, 0) +
+                   " cycles/sample",
+               area.removeFromTop(16), juce::Justification::topLeft);
+
+    // each row is labelled with the stage's cycles per sample summed over the voices
+    auto labels = area.removeFromLeft(70);
+    const float rowH = area.getHeight() / (float)XenosVoice::numCycleStages;
+    const float colW = area.getWidth() / (float)juce::jmax(1, (int)columns.size());
+    for (int i = 0; i < XenosVoice::numCycleStages; ++i)
+    {
+        const float y = area.getY() + rowH * i;
+        g.setColour(juce::Colours::white);
+        g.drawText(juce::String(stageNames[i]) + " " + juce::String(stageTotals[i], 0),
+                   juce::Rectangle<float>((float)labels.getX(), y, (float)labels.getWidth(), rowH),
+                   juce::Justification::centredLeft);
+        for (int c = 0; c < (int)columns.size(); ++c)
+        {
+            const float heat = hottest > 0.0f ? columns[c].cyclesPerSample[i] / hottest : 0.0f;
+            g.setColour(getHeatColour(heat));
+            g.fillRect(area.getX() + colW * c, y, colW, rowH);
+        }
     }
 }
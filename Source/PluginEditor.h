@@ -16,6 +16,7 @@
 #include "ParamMenu.h"
 #include "ParamSlider.h"
 #include "PluginProcessor.h"
+#include "ScaleLibrary.h"
 
 //==============================================================================
 
@@ -102,13 +103,70 @@ class XenosLookAndFeel : public juce::LookAndFeel_V4
 class PitchVisualizer : public juce::Component, juce::Timer
 {
   public:
+    // The voices are read from the synth's telemetry snapshot, never from the voices themselves
     PitchVisualizer(XenosSynth &syn, Quantizer2 &q) : synth(syn), quan(q) { startTimerHz(30); }
     void timerCallback() override { repaint(); }
     void paint(juce::Graphics &g) override;
 
   private:
+    // the ticks of the tuning, redrawn only when the tuning or the size changes
+    void updateTickLayer(float scale, bool external);
+
     XenosSynth &synth;
     Quantizer2 &quan;
+    juce::Image tickLayer;
+    unsigned int tickLayerVersion = 0;
+    int tickLayerScale = -1;
+    bool tickLayerExternal = false;
+};
+
+// One cycle of the voices' waveforms, drawn from the breakpoint snapshots the synth publishes
+// while the scope is showing. A click switches between all voices and the newest one.
+class BreakpointScope : public juce::Component, juce::Timer
+{
+  public:
+    BreakpointScope(BreakpointScopeFeed &f) : feed(f) { startTimerHz(30); }
+    ~BreakpointScope() override { feed.setEnabled(false); }
+    void timerCallback() override;
+    void paint(juce::Graphics &g) override;
+    void mouseDown(const juce::MouseEvent &) override;
+
+  private:
+    struct Trace
+    {
+        BreakpointSnapshot snapshot;
+        juce::uint32 updated = 0;
+    };
+    BreakpointScopeFeed &feed;
+    std::map<int, Trace> traces;
+    int newestVoice = -1;
+};
+
+// The voices' cycles per sample since the last update, as a heat map with a column for every
+// voice that rendered and a row for each of the DSS, envelope and pan stages. The cycles are
+// only counted while the map is showing.
+class VoiceCpuHeatMap : public juce::Component, juce::Timer
+{
+  public:
+    VoiceCpuHeatMap(XenosSynth::CpuStats &s) : stats(s)
+    {
+        columns.reserve(MAX_VOICES);
+        startTimerHz(5);
+    }
+    ~VoiceCpuHeatMap() override { stats.setEnabled(false); }
+    void timerCallback() override;
+    void paint(juce::Graphics &g) override;
+
+  private:
+    struct Column
+    {
+        int voiceId = -1;
+        std::array<float, XenosVoice::numCycleStages> cyclesPerSample{};
+    };
+    XenosSynth::CpuStats &stats;
+    XenosSynth::CpuStats::Snapshot previous, current;
+    bool counting = false;
+    std::vector<Column> columns;
 };
 
 class XenosAudioProcessorEditor : public juce::AudioProcessorEditor,
@@ -137,13 +195,17 @@ class XenosAudioProcessorEditor : public juce::AudioProcessorEditor,
     void initParamMenu(ParamMenu &menu, std::string p, std::string d, float labelOffsetX = 0.0f,
                        int numEntriesToAdd = 0);
     void buttonClicked(juce::Button *button) override;
+    void showCustomScaleMenu();
     void loadCustomScale();
+    bool applyCustomScale(const juce::String &text, const juce::String &name);
     void mouseDown(const juce::MouseEvent &ev) override;
+    void showPerformanceMenu();
 
   private:
     XenosAudioProcessor &audioProcessor;
     juce::AudioProcessorValueTreeState &valueTreeState;
     XenosLookAndFeel xenosLookAndFeel;
+    juce::TooltipWindow tooltipWindow{this};
     juce::Label cpuLoadLabel;
     ParamSlider pitchWidth;
     ParamSlider pitchBarrier;
@@ -169,6 +231,7 @@ class XenosAudioProcessorEditor : public juce::AudioProcessorEditor,
 
     ParamMenu scale;
     juce::TextButton customButton;
+    juce::SharedResourcePointer<ScaleLibrary> scaleLibrary;
     ParamSlider root;
 
     ParamMenu voicepanmode;
@@ -176,6 +239,8 @@ class XenosAudioProcessorEditor : public juce::AudioProcessorEditor,
 
     juce::MidiKeyboardComponent keyboardComponent;
     PitchVisualizer pitchVisualizer;
+    BreakpointScope breakpointScope;
+    VoiceCpuHeatMap cpuHeatMap;
 
     juce::Label pitchLabel, amplitudeLabel, envelopeLabel;
 
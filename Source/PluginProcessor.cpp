@@ -166,33 +166,12 @@ XenosAudioProcessor::XenosAudioProcessor()
                   0)})
 #endif
 {
-    segmentsParam = params.getRawParameterValue("segments");
-    pitchWidthParam = params.getRawParameterValue("pitchWidth");
-    pitchBarrierParam = params.getRawParameterValue("pitchBarrier");
-    pitchStepParam = params.getRawParameterValue("pitchStep");
-    ampGainParam = params.getRawParameterValue("ampGain");
-    ampBarrierParam = params.getRawParameterValue("ampBarrier");
-    ampStepParam = params.getRawParameterValue("ampStep");
-
-    pitchDistributionParam = params.getRawParameterValue("pitchDistribution");
-    pitchWalkParam = params.getRawParameterValue("pitchWalk");
-    pitchAlphaParam = params.getRawParameterValue("pitchAlpha");
-    pitchBetaParam = params.getRawParameterValue("pitchBeta");
-
-    ampDistributionParam = params.getRawParameterValue("ampDistribution");
-    ampWalkParam = params.getRawParameterValue("ampWalk");
-    ampAlphaParam = params.getRawParameterValue("ampAlpha");
-    ampBetaParam = params.getRawParameterValue("ampBeta");
-
-    attackParam = params.getRawParameterValue("attack");
-    decayParam = params.getRawParameterValue("decay");
-    sustainParam = params.getRawParameterValue("sustain");
-    releaseParam = params.getRawParameterValue("release");
-
-    scaleParam = params.getRawParameterValue("scale");
-    rootParam = params.getRawParameterValue("root");
-
-    hpFilterParam = params.getRawParameterValue("mainhpfilterfrequency");
+    for (int i = 0; i < (int)XenosParam::numParams; ++i)
+    {
+        paramValues[i] = params.getRawParameterValue(getXenosParamID((XenosParam)i));
+        jassert(paramValues[i] != nullptr);
+    }
+    xenosAudioSource.attachParameters(paramValues);
 }
 
 XenosAudioProcessor::~XenosAudioProcessor() {}
@@ -251,19 +230,60 @@ void XenosAudioProcessor::prepareToPlay(double sampleRate, int samplesPerBlock)
     // initialisation that you need..
 
     xenosAudioSource.prepareToPlay(samplesPerBlock, sampleRate);
-    juce::dsp::ProcessSpec spec;
-    spec.numChannels = 2;
-    spec.maximumBlockSize = samplesPerBlock;
-    spec.sampleRate = sampleRate;
-    outputFilter.prepare(spec);
-    outputFilter.setType(juce::dsp::StateVariableTPTFilterType::highpass);
-    outputFilter.setCutoffFrequency(16.0f);
-    outputFilter.setResonance(1.0 / std::sqrt(2.0f));
+    preparedBlockSize = samplesPerBlock;
+    setNumRenderThreads(numRenderThreads); // the pool's buffers depend on the block size
+    outputStage.prepare(sampleRate);
     loadMeasurer.reset(sampleRate, samplesPerBlock);
+    blockTiming.prepare(sampleRate);
 }
 
 void XenosAudioProcessor::releaseResources() {}
 
+void XenosAudioProcessor::setNumRenderThreads(int numThreads)
+{
+    numRenderThreads = juce::jlimit(1, juce::SystemStats::getNumCpus(), numThreads);
+    auto *current = xenosAudioSource.xenosSynth.getRenderPool();
+    if (current && current->getNumThreads() == numRenderThreads &&
+        current->getMaxBlockSize() == preparedBlockSize)
+        return;
+    std::unique_ptr<VoiceRenderPool> pool;
+    if (numRenderThreads > 1)
+        pool = std::make_unique<VoiceRenderPool>(numRenderThreads, preparedBlockSize);
+    {
+        const juce::ScopedLock sl(getCallbackLock());
+        pool = xenosAudioSource.setRenderPool(std::move(pool));
+    }
+    // the old pool's threads get joined here, outside the lock
+}
+
+void XenosAudioProcessor::setPolyphony(int numVoices)
+{
+    auto &synth = xenosAudioSource.xenosSynth;
+    numVoices = juce::jlimit(1, MAX_VOICES, numVoices);
+    if (numVoices > synth.getNumVoices())
+    {
+        auto newVoices = xenosAudioSource.createVoices(numVoices - synth.getNumVoices());
+        for (auto &v : newVoices)
+        {
+            for (int i = 0; i < (int)XenosParam::numParams; ++i)
+                xenosAudioSource.setVoiceParam(*v, (XenosParam)i, paramValues[i]->load());
+        }
+        const juce::ScopedLock sl(getCallbackLock());
+        synth.addVoices(newVoices);
+    }
+    synth.setPolyphony(numVoices);
+}
+
+void XenosAudioProcessor::setCpuBudget(float budget)
+{
+    xenosAudioSource.xenosSynth.getGovernor().setBudget(budget);
+}
+
+float XenosAudioProcessor::getCpuBudget() const
+{
+    return xenosAudioSource.xenosSynth.getGovernor().getBudget();
+}
+
 #ifndef JucePlugin_PreferredChannelConfigurations
 bool XenosAudioProcessor::isBusesLayoutSupported(const BusesLayout &layouts) const
 {
@@ -290,28 +310,26 @@ bool XenosAudioProcessor::isBusesLayoutSupported(const BusesLayout &layouts) con
 }
 #endif
 
-template <typename F> inline void update_dsp_if_needed(float &previousvalue, float newvalue, F &&f)
-{
-    if (previousvalue != newvalue)
-    {
-        f(newvalue);
-        previousvalue = newvalue;
-    }
-}
-
 void XenosAudioProcessor::processBlock(juce::AudioBuffer<float> &buffer,
                                        juce::MidiBuffer &midiMessages)
 {
     juce::AudioProcessLoadMeasurer::ScopedTimer bt(loadMeasurer, buffer.getNumSamples());
-
-    xenosAudioSource.processBlock(buffer, midiMessages);
-    juce::dsp::AudioBlock<float> block(buffer);
-    juce::dsp::ProcessContextReplacing<float> ctx(block);
-    // we could probably afford setting the filter frequency always, but let's do this optimization
-    // here
-    update_dsp_if_needed(previousOutputFilterFrequency, *hpFilterParam,
-                         [this](float x) { outputFilter.setCutoffFrequency(x); });
-    outputFilter.process(ctx);
+    BlockTimingHistogram::ScopedTimer blockTimer(blockTiming, buffer.getNumSamples());
+    rt_guard::ScopedRealtimeContext realtimeContext;
+
+    xenosAudioSource.xenosSynth.setMeasuredLoad((float)loadMeasurer.getLoadAsProportion());
+    const bool rendered = xenosAudioSource.processBlock(buffer, midiMessages);
+    outputStage.setCutoffFrequency(getParamValue(XenosParam::mainhpfilterfrequency));
+    outputStage.setGain(juce::Decibels::decibelsToGain(outputGainDecibels.load()));
+    outputStage.setLimiterEnabled(outputLimiter.load());
+    // once the voices and the filter's tail have died away the cleared buffer is the output
+    if (!rendered && outputStage.hasDecayed())
+    {
+        outputStage.skipSilentBlock();
+        return;
+    }
+    outputStage.process(buffer.getArrayOfWritePointers(), buffer.getNumChannels(),
+                        buffer.getNumSamples());
 }
 
 //==============================================================================
@@ -328,62 +346,92 @@ juce::AudioProcessorEditor *XenosAudioProcessor::createEditor()
 //==============================================================================
 void XenosAudioProcessor::getStateInformation(juce::MemoryBlock &destData)
 {
-    // You should use this method to store your parameters in the memory block.
-    // You could do that either as raw data, or use the XML or ValueTree classes
-    // as intermediaries to make it easy to save and load complex data.
-
-    auto state = params.copyState();
-
-    juce::XmlElement xmlParent("parent");
-
-    std::unique_ptr<juce::XmlElement> xmlParams(state.createXml());
-    xmlParent.addChildElement(xmlParams.release());
+    // Saved as a binary StateChunk, older versions saved XML, which setStateInformation still
+    // reads
+    StateChunk chunk;
+    chunk.paramValues.resize((size_t)XenosParam::numParams);
+    for (int i = 0; i < (int)XenosParam::numParams; ++i)
+        chunk.paramValues[i] = {getXenosParamID((XenosParam)i), paramValues[i]->load()};
+    chunk.renderThreads = numRenderThreads;
+    chunk.polyphony = getPolyphony();
+    chunk.cpuBudget = getCpuBudget();
+    chunk.voiceSleepLevel = xenosAudioSource.getVoiceSleepLevel();
+    chunk.outputGain = getOutputGain();
+    chunk.outputLimiter = getOutputLimiter();
+
+    chunk.customScaleName = customScaleName;
+    chunk.customScaleData = customScaleData.joinIntoString("\n");
+    chunk.customScaleText = customScaleText;
+    chunk.customKbmText = customKbmText;
+    if (auto *scl = xenosAudioSource.getCustomScl())
+    {
+        chunk.hasScl = true;
+        chunk.scl = *scl;
+    }
+    if (auto *kbm = xenosAudioSource.getCustomKbm())
+    {
+        chunk.hasKbm = true;
+        chunk.kbm = *kbm;
+    }
+    destData.reset();
+    chunk.writeTo(destData);
+}
 
-    juce::XmlElement *xmlScale =
-        xmlParent.createNewChildElement("scaleParams"); // add custom scale data to xml tree
-    xmlScale->setAttribute(juce::Identifier(juce::String("CUSTOM_SCALE_DATA")),
-                           customScaleData.joinIntoString("\n"));
-    xmlScale->setAttribute(juce::Identifier(juce::String("CUSTOM_SCALE_NAME")), customScaleName);
-    xmlScale->setAttribute(juce::Identifier(juce::String("CUSTOM_SCALE_DATA2")), customScaleText);
-    copyXmlToBinary(xmlParent, destData);
+// All parameters are set in one pass without parsing anything, the scale and keyboard mapping
+// come already parsed, and the voices pick up the parameters with the next block. The values are
+// matched to the parameters by ID and restored through the parameter tree, not set one by one
+// as edits for the host. Parameters the chunk doesn't have get their defaults, values of unknown
+// ones are dropped.
+void XenosAudioProcessor::applyStateChunk(const StateChunk &chunk)
+{
+    setNumRenderThreads(chunk.renderThreads);
+    juce::ValueTree state(params.state.getType());
+    for (auto &id : getXenosParamIDs())
+    {
+        auto *param = params.getParameter(id);
+        if (param == nullptr)
+            continue;
+        float value = param->convertFrom0to1(param->getDefaultValue());
+        for (auto &p : chunk.paramValues)
+            if (p.id == id)
+                value = p.value;
+        state.appendChild(juce::ValueTree("PARAM", {{"id", id}, {"value", value}}), nullptr);
+    }
+    params.replaceState(state);
+
+    customScaleName = chunk.customScaleName;
+    customScaleData.clear();
+    if (chunk.customScaleData.isNotEmpty())
+        customScaleData.addLines(chunk.customScaleData);
+    customScaleText = chunk.customScaleText;
+    customKbmText = chunk.customKbmText;
+    if (!chunk.hasKbm || !xenosAudioSource.loadKbmData(chunk.kbm, customKbmText.toStdString()))
+        xenosAudioSource.resetKbm();
+    // the audio thread picks up the scale parameter with its next block
+    if (chunk.hasScl)
+        xenosAudioSource.loadScalaData(chunk.scl, customScaleText.toStdString());
+
+    setPolyphony(chunk.polyphony > 0 ? chunk.polyphony : NUM_VOICES);
+    setCpuBudget(chunk.cpuBudget);
+    xenosAudioSource.setVoiceSleepLevel(chunk.voiceSleepLevel);
+    setOutputGain(chunk.outputGain);
+    setOutputLimiter(chunk.outputLimiter);
 }
 
 void XenosAudioProcessor::setStateInformation(const void *data, int sizeInBytes)
 {
-    // You should use this method to restore your parameters from this memory
-    // block, whose contents will have been created by the getStateInformation()
-    // call.
-
-    std::unique_ptr<juce::XmlElement> xmlState(getXmlFromBinary(data, sizeInBytes));
-    juce::XmlElement *xmlParams = xmlState->getChildByName(params.state.getType());
-    juce::XmlElement *xmlScale = xmlState->getChildByName("scaleParams");
-
-    if (xmlState.get() != nullptr)
+    StateChunk chunk;
+    if (chunk.readFrom(data, sizeInBytes))
     {
-        if (xmlParams->hasTagName(params.state.getType()))
-        {
-            params.replaceState(juce::ValueTree::fromXml(*xmlParams));
-            auto n = params.state.getNumChildren();
-            for (int i = 0; i < n; ++i)
-            { // recall stored parameters
-                auto child = params.state.getChild(i);
-                auto id = child["id"];
-                auto value = child["value"];
-                xenosAudioSource.setParam(id, value);
-            }
-        }
-        if (xmlScale->hasTagName(juce::StringRef("scaleParams")))
-        {
-            customScaleName =
-                xmlScale->getStringAttribute(juce::String("CUSTOM_SCALE_NAME"), "custom");
-            juce::String scaleData =
-                xmlScale->getStringAttribute(juce::String("CUSTOM_SCALE_DATA"), "");
-            customScaleData.clear();
-            if (scaleData != "")
-                customScaleData.addLines(scaleData);
-            xenosAudioSource.loadScl(customScaleData, *scaleParam == customScaleParamIndex);
-        }
+        applyStateChunk(chunk);
+        return;
     }
+    // from a newer version or damaged, better to keep the current state
+    if (StateChunk::isStateChunk(data, sizeInBytes))
+        return;
+    // older versions saved XML, it's read into a chunk and restored the same way
+    if (chunk.readFromLegacyXml(data, sizeInBytes, params.state.getType()))
+        applyStateChunk(chunk);
 }
 
 //==============================================================================
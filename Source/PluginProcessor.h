@@ -14,6 +14,10 @@
 
 #include <JuceHeader.h>
 #include "Xenos.h"
+#include "StateChunk.h"
+#include "OutputStage.h"
+#include "BlockTimingHistogram.h"
+#include "RealtimeGuard.h"
 
 //==============================================================================
 /**
@@ -64,48 +68,52 @@ class XenosAudioProcessor : public juce::AudioProcessor
     juce::String customScaleName;
     juce::StringArray customScaleData;
     juce::String customScaleText;
+    juce::String customKbmText;
 
     XenosSynthHolder xenosAudioSource;
     const int numActualVoicePanModes = 6;
     juce::AudioProcessLoadMeasurer loadMeasurer;
+    // the distribution of the audio callback durations, for the editor and for monitoring
+    BlockTimingHistogram blockTiming;
+    BlockTimingHistogram::Report getBlockTimingReport() const { return blockTiming.getReport(); }
+#if XENOS_TRACE
+    // records the trace points while any instance is alive, see TraceRecorder.h
+    juce::SharedResourcePointer<trace::TraceRecorder> traceRecorder;
+#endif
+
+    // 1 renders all voices on the audio thread, more starts a VoiceRenderPool
+    void setNumRenderThreads(int numThreads);
+    int getNumRenderThreads() const { return numRenderThreads; }
+
+    // Grows the voice pool when needed, the voices are never freed again while running
+    void setPolyphony(int numVoices);
+    int getPolyphony() const { return xenosAudioSource.xenosSynth.getPolyphony(); }
+    // proportion of the block time the voices may use before they're shed, 0 for no limit
+    void setCpuBudget(float budget);
+    float getCpuBudget() const;
+    // master gain and the soft limiter of the output stage
+    void setOutputGain(float decibels) { outputGainDecibels.store(decibels); }
+    float getOutputGain() const { return outputGainDecibels.load(); }
+    void setOutputLimiter(bool enabled) { outputLimiter.store(enabled); }
+    bool getOutputLimiter() const { return outputLimiter.load(); }
 
   private:
+    int numRenderThreads = 1;
+    int preparedBlockSize = 512;
+
     //==============================================================================
     juce::AudioProcessorValueTreeState params;
 
-    std::atomic<float> *segmentsParam = nullptr;
-
-    std::atomic<float> *pitchWidthParam = nullptr;
-    std::atomic<float> *pitchBarrierParam = nullptr;
-    std::atomic<float> *pitchStepParam = nullptr;
-    std::atomic<float> *ampGainParam = nullptr;
-    std::atomic<float> *ampBarrierParam = nullptr;
-    std::atomic<float> *ampStepParam = nullptr;
-
-    std::atomic<float> *pitchDistributionParam = nullptr;
-    std::atomic<float> *pitchWalkParam = nullptr;
-    std::atomic<float> *pitchAlphaParam = nullptr;
-    std::atomic<float> *pitchBetaParam = nullptr;
-
-    std::atomic<float> *ampDistributionParam = nullptr;
-    std::atomic<float> *ampWalkParam = nullptr;
-    std::atomic<float> *ampAlphaParam = nullptr;
-    std::atomic<float> *ampBetaParam = nullptr;
-
-    std::atomic<float> *attackParam = nullptr;
-    std::atomic<float> *decayParam = nullptr;
-    std::atomic<float> *sustainParam = nullptr;
-    std::atomic<float> *releaseParam = nullptr;
-
-    std::atomic<float> *scaleParam = nullptr;
-    std::atomic<float> *rootParam = nullptr;
+    XenosParamValues paramValues{};
+    float getParamValue(XenosParam param) const { return paramValues[(size_t)param]->load(); }
 
-    std::atomic<float> *hpFilterParam = nullptr;
+    void applyStateChunk(const StateChunk &chunk);
 
     const int customScaleParamIndex = SCALE_PRESETS + 1;
 
-    juce::dsp::StateVariableTPTFilter<float> outputFilter;
-    float previousOutputFilterFrequency = 0.0f;
+    OutputStage outputStage;
+    std::atomic<float> outputGainDecibels{0.0f};
+    std::atomic<bool> outputLimiter{false};
 
     JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(XenosAudioProcessor)
 };
@@ -10,22 +10,37 @@
   ==============================================================================
 */
 
+#include <algorithm>
+#include <cmath>
 #include "Quantizer.h"
 #include "Utility.h"
 
-void Quantizer::loadScl(juce::StringArray s, bool load)
+void Quantizer::setSettings(const QuantizerSettings *s)
 {
-    const auto nPresets = scale.size() - 1;
-    scale[nPresets] = Scale(s);
-    if (load) setScale(nPresets);
+    settings = s;
+    reserveSteps(reservedSteps);
+    calcSteps();
+}
+
+void Quantizer::update()
+{
+    if (settings && (settings->version != builtVersion || rangeChanged))
+        calcSteps();
 }
 
 void Quantizer::calcSteps()
 {
     steps.clear();
+    rangeChanged = false;
+    if (!settings || !settings->scale)
+        return;
+    builtVersion = settings->version;
+    const Scale *scalePtr = settings->scale;
     double start = calcStart();
     while (start <= pitchRange[0]) {
         for (int i = 0; i < scalePtr->size(); i++) {
+            // growing the vector would allocate on the audio thread
+            jassert(steps.size() < steps.capacity());
             double q = mtos(start) / scalePtr->getInterval(i);
             steps.push_back(q);
         }
@@ -35,15 +50,15 @@ void Quantizer::calcSteps()
 
 double Quantizer::calcStart()
 { // get the highest root transposition <= pitchRange[0]
-    double s = root;
-    double repeatPointMidi = rtoc(scalePtr->getRepeatRatio()) / 100.0;
+    double s = settings->root;
+    double repeatPointMidi = rtoc(settings->scale->getRepeatRatio()) / 100.0;
     while (s < pitchRange[1] - repeatPointMidi) s += repeatPointMidi;
     return s;
 }
 
 double Quantizer::operator()(double per)
 {
-    if (active) {
+    if (settings && settings->active && !steps.empty()) {
         double min = 999999;
         int step = 0;
         for (int i = 0; i < steps.size(); i++) {
@@ -61,28 +76,42 @@ double Quantizer::operator()(double per)
 
 double Quantizer::getFactor() { return factor; }
 
-void Quantizer::setActive(bool a)
-{
-    if (active != a) active = a;
-}
-
 void Quantizer::setFactor(double sP) { factor = (*this)(sP) / sP; }
 
 void Quantizer::setRange(double hi, double lo)
 {
     if (hi == lo) hi += 0.000001; // quantizer misbehaves with a range of 0
+    if (hi == pitchRange[0] && lo == pitchRange[1]) return;
+    rangeChanged = true;
     pitchRange[0] = hi;
     pitchRange[1] = lo;
 }
 
-void Quantizer::setRoot(const double r)
+size_t Quantizer::getMemoryUsage() const
 {
-    root = (r > 11.9999999) ? 0.0 : r;
-    calcSteps();
+    return stepCapacity.load(std::memory_order_relaxed) * sizeof(double);
 }
 
-void Quantizer::setScale(const unsigned char n)
+size_t Quantizer::getMaxSteps(const Scale &scale)
 {
-    scalePtr = &scale[n];
-    calcSteps();
+    // calcSteps starts less than a period below the range and adds whole periods until it's
+    // past the top, the range may be a hair wider than maxPitchWidth (see setRange)
+    const double period = std::max(rtoc(scale.getRepeatRatio()) / 100.0, 1.0e-3);
+    const size_t numPeriods = (size_t)std::floor((maxPitchWidth + 1.0e-3) / period) + 2;
+    return std::max((size_t)reservedSteps, numPeriods * (size_t)scale.size());
+}
+
+void Quantizer::reserveSteps(size_t numSteps)
+{
+    steps.reserve(numSteps);
+    stepCapacity.store(steps.capacity(), std::memory_order_relaxed);
+}
+
+void Quantizer::swapStepBuffer(std::vector<double> &buffer)
+{
+    if (buffer.capacity() < steps.size())
+        return;
+    buffer.assign(steps.begin(), steps.end());
+    steps.swap(buffer);
+    stepCapacity.store(steps.capacity(), std::memory_order_relaxed);
 }
@@ -12,61 +12,55 @@
 
 #pragma once
 
+#include <atomic>
 #include "Scale.h"
 
+// Quantizer state that is the same for all voices. Owned by the engine, the scale pointed to
+// lives either in the shared ScaleStore or in the engine (custom scale). Voices notice changes
+// through the version number and rebuild their steps lazily.
+struct QuantizerSettings
+{
+    const Scale *scale = nullptr;
+    double root = 0.0;
+    bool active = false;
+    unsigned int version = 0;
+};
+
 class Quantizer {
 public:
-    void loadScl(juce::StringArray s, bool load);
+    void setSettings(const QuantizerSettings *s);
+    // rebuilds the steps if the settings or the range changed since they were last built
+    void update();
     void calcSteps();
     double calcStart();
     double operator()(double per);
 
     double getFactor();
-    void setActive(bool a);
     void setFactor(double sP);
     void setRange(double hi, double lo);
-    void setRoot(const double r);
-    void setScale(const unsigned char n);
+    size_t getMemoryUsage() const;
+
+    // The most steps calcSteps makes of a scale, over the widest pitch range
+    static size_t getMaxSteps(const Scale &scale);
+    // not while the audio thread uses the quantizer
+    void reserveSteps(size_t numSteps);
+    // Audio thread: takes over a buffer reserved on the message thread, keeping the steps, and
+    // leaves the old one in its place
+    void swapStepBuffer(std::vector<double> &buffer);
+
+    // the widest pitch range in semitones, that of the pitchWidth parameter
+    static constexpr double maxPitchWidth = 96.0;
 private:
-    double root = 0.0;
     double pitchRange[2] = {48.5, 47.5};
     double factor = 1.0;
     std::vector<double> steps;
-    bool active = false;
-    std::array<Scale, 15> scale = {
-        Scale({1., 1.122462, 1.259921, 1.498307, 1.681793}, 2), // pentatonic
-        Scale({1., 1.125, 1.265625, 1.5, 1.6875},
-              2), // pentatonic (pythagorean)
-        Scale({1., 1.189207, 1.33484, 1.414214, 1.498307, 1.781797},
-              2), // blues
-        Scale({1., 1.166667, 1.333333, 1.4, 1.5, 1.75}, 2), // blues (7-limit)
-        Scale({1., 1.122462, 1.259921, 1.414214, 1.587401, 1.781797},
-              2), // whole-tone
-        Scale({1., 1.122462, 1.259921, 1.33484, 1.498307, 1.681793, 1.887749},
-              2), // major
-        Scale({1., 1.125, 1.25, 1.333333, 1.5, 1.666667, 1.875},
-              2), // major (5-limit)
-        Scale({1., 1.122462, 1.189207, 1.33484, 1.498307, 1.587401, 1.781797},
-              2), // minor
-        Scale({1., 1.125, 1.2, 1.333333, 1.5, 1.6, 1.777778},
-              2), // minor (5-limit)
-        Scale({1., 1.122462, 1.189207, 1.33484, 1.414214, 1.587401, 1.681793,
-               1.887749},
-              2), // octatonic
-        Scale({1., 1.125, 1.25, 1.375, 1.5, 1.625, 1.75, 1.875}, 2), // overtone
-        Scale({1., 1.059463, 1.122462, 1.189207, 1.259921, 1.33484, 1.414214,
-               1.498307, 1.587401, 1.681793, 1.781797, 1.887749},
-              2), // chromatic
-        Scale({1., 1.088182, 1.18414, 1.288561, 1.402189, 1.525837, 1.660388,
-               1.806806, 1.966134, 2.139512, 2.328178, 2.533484, 2.756892},
-              3), // bohlen–pierce
-        Scale({1.,       1.029302, 1.059463, 1.090508, 1.122462, 1.155353,
-               1.189207, 1.224054, 1.259921, 1.29684,  1.33484,  1.373954,
-               1.414214, 1.455653, 1.498307, 1.542211, 1.587401, 1.633915,
-               1.681793, 1.731073, 1.781797, 1.834008, 1.887749, 1.943064},
-              2), // quarter-tone
-        Scale() // custom scale placeholder
-    };
-    Scale* scalePtr = &scale[0];
-    const unsigned long nPresets = scale.size();
+    // the capacity of steps, for reading on other threads while the audio thread swaps it
+    std::atomic<size_t> stepCapacity{0};
+    const QuantizerSettings *settings = nullptr;
+    unsigned int builtVersion = 0;
+    bool rangeChanged = false;
+    // calcSteps runs on the audio thread and mustn't allocate, the owner reserves the room for
+    // larger scales with reserveSteps or swapStepBuffer before they're used. This much covers
+    // scales up to about 25 notes per octave.
+    static constexpr int reservedSteps = 256;
 };
@@ -14,6 +14,9 @@
 #include <cmath>
 #include "RandomSource.h"
 
+const RandomSourceParams RandomSource::defaultParams;
+
+
 double RandomSource::uniform(double a) { return uniformDist(generator) * a; }
 
 double RandomSource::normal(double a, double b)
@@ -65,8 +68,9 @@ double RandomSource::operator()()
 {
     double rand = uniformDist(generator);
     int sign = (rand < 0.5) * 2 - 1;
+    const double alpha = params->alpha, beta = params->beta;
     double v;
-    switch (mode)
+    switch (params->mode)
     {
     case 0:
         v = uniform(alpha);
@@ -108,8 +112,4 @@ double RandomSource::operator()()
     return v;
 }
 
-void RandomSource::setMode(int m) { mode = m; }
-
-void RandomSource::setAlpha(double a) { alpha = a; }
-
-void RandomSource::setBeta(double b) { beta = b; }
+void RandomSource::setParams(const RandomSourceParams* p) { params = p; }
@@ -14,6 +14,13 @@
 
 #include <random>
 
+// The distribution settings, the same in every voice. The engine keeps one per source and the
+// voices' sources refer to it.
+struct RandomSourceParams {
+    int mode = 0;
+    double alpha = 1, beta = 1;
+};
+
 class RandomSource {
 public:
     double uniform(double a = 1);
@@ -28,15 +35,14 @@ public:
     double sinus(double z, double a = 1, double b = 1);
     double operator()();
 
-    void setMode(int m);
-    void setAlpha(double a);
-    void setBeta(double b);
+    void setParams(const RandomSourceParams* p);
 private:
-    std::random_device s;
-    std::default_random_engine generator{s()};
+    static const RandomSourceParams defaultParams;
+    const RandomSourceParams* params = &defaultParams;
+    // seeded from a temporary std::random_device, keeping one around per source
+    // costs several kilobytes per voice with some standard libraries
+    std::default_random_engine generator{std::random_device{}()};
     std::uniform_real_distribution<double> uniformDist{0.0, 1.0};
     std::normal_distribution<double> normalDist{5, 2};
     std::poisson_distribution<int> poissonDist{4.1};
-    int mode = 0;
-    double alpha = 1, beta = 1;
 };
@@ -14,6 +14,8 @@
 #include "RandomWalk.h"
 #include "Utility.h"
 
+const RandomWalkParams RandomWalk::defaultParams;
+
 void RandomWalk::initialize(int n)
 {
     pri.resize(n);
@@ -26,48 +28,29 @@ void RandomWalk::reset(int i, double v)
     sec[i] = v;
 }
 
-void RandomWalk::setParams(double* pR, int nP)
+void RandomWalk::setShared(const RandomWalkParams* p, bool sharedBarriers)
 {
-    calcSecBarriers(pR, nP);
-    calcPriBarriers();
-    calcPriStepSize();
+    params = p;
+    useSharedBarriers = sharedBarriers;
 }
 
-void RandomWalk::setParams(double v)
-{
-    setSecBarriers(v);
-    calcPriBarriers();
-    calcPriStepSize();
-}
+void RandomWalk::setParams(double* pR, int nP) { calcSecBarriers(pR, nP); }
 
 void RandomWalk::calcSecBarriers(double* pR, int nP)
 {
-    secBarrier[0] = pR[1] / nP; // lo samps/hi freq
-    secBarrier[1] = pR[0] / nP; // hi samps/lo freq
+    ownSecBarrier[0] = pR[1] / nP; // lo samps/hi freq
+    ownSecBarrier[1] = pR[0] / nP; // hi samps/lo freq
 }
 
-void RandomWalk::setSecBarriers(double v)
-{
-    secBarrier[0] = v * -1;
-    secBarrier[1] = v;
-}
-
-void RandomWalk::calcPriBarriers()
+void RandomWalk::step(int n, double r)
 {
+    // the step sizes follow from the shared ratios, only the barriers may belong to the voice
+    const double* secBarrier = useSharedBarriers ? params->secBarrier : ownSecBarrier;
     double secWalkSize = secBarrier[1] - secBarrier[0];
-    secStepSize = secWalkSize * stepRatio;
-    priBarrier = secWalkSize / 2 * barrierRatio;
-}
-
-void RandomWalk::calcPriStepSize()
-{
-    double priWalkSize = priBarrier * 2;
-    priStepSize = priWalkSize * stepRatio;
-}
+    if (params->walk) {
+        double priBarrier = secWalkSize * params->priBarrierRatio;
+        double priStepSize = secWalkSize * params->priStepRatio;
 
-void RandomWalk::step(int n, double r)
-{
-    if (walk) {
         // scale primary walk step
         double rnd = r * priStepSize;
 
@@ -79,7 +62,7 @@ void RandomWalk::step(int n, double r)
         sec[n] += pri[n];
         sec[n] = reflect(sec[n], secBarrier[0], secBarrier[1]);
     } else {
-        double rnd = r * secStepSize;
+        double rnd = r * secWalkSize * params->secStepRatio;
 
         // do secondary walk, primary style
         sec[n] += rnd;
@@ -137,18 +120,32 @@ double RandomWalk::getSumPeriod()
     return temp;
 }
 
-void RandomWalk::setBarrierRatio(double bR)
+size_t RandomWalk::getMemoryUsage() const
+{
+    return (pri.capacity() + sec.capacity()) * sizeof(double);
+}
+
+void RandomWalkParams::setBarrierRatio(double bR)
 {
     barrierRatio = bR;
-    calcPriBarriers();
-    calcPriStepSize();
+    update();
 }
 
-void RandomWalk::setStepRatio(double sR)
+void RandomWalkParams::setStepRatio(double sR)
 {
     stepRatio = sR;
-    calcPriBarriers();
-    calcPriStepSize();
+    update();
+}
+
+void RandomWalkParams::setSecBarriers(double v)
+{
+    secBarrier[0] = v * -1;
+    secBarrier[1] = v;
 }
 
-void RandomWalk::setWalk(bool w) { walk = w; }
+void RandomWalkParams::update()
+{
+    secStepRatio = stepRatio;
+    priBarrierRatio = barrierRatio / 2;
+    priStepRatio = priBarrierRatio * 2 * stepRatio;
+}
@@ -14,16 +14,32 @@
 
 #include <vector>
 
+// The settings of a walk that are the same in every voice. The engine keeps one per walk and
+// the voices' walks refer to it, so a change is made once for all of them.
+struct RandomWalkParams {
+    void setBarrierRatio(double bR);
+    void setStepRatio(double sR);
+    void setWalk(bool w) { walk = w; }
+    // secondary barriers at -v and v, for the walks that share them
+    void setSecBarriers(double v);
+
+    bool walk = true;
+    double secBarrier[2] = {-1.0, 1.0};
+    // the step sizes and the primary barrier, relative to the width of the secondary walk
+    double secStepRatio = 0.01, priBarrierRatio = 0.05, priStepRatio = 0.001;
+private:
+    void update();
+    double barrierRatio = 0.1, stepRatio = 0.01;
+};
+
 class RandomWalk {
 public:
     void initialize(int n);
     void reset(int i, double v);
+    // with sharedBarriers the walk uses the barriers of the params, otherwise its own
+    void setShared(const RandomWalkParams* p, bool sharedBarriers);
     void setParams(double* pR, int nP);
-    void setParams(double v);
     void calcSecBarriers(double* pR, int nP);
-    void setSecBarriers(double v);
-    void calcPriBarriers();
-    void calcPriStepSize();
     void step(int n, double r);
     double reflect(double val, double min, double max);
     double realLookup(std::vector<double>& a, double x, int nP);
@@ -31,14 +47,13 @@ public:
     double operator()(double idx, int nP);
 
     double getSumPeriod();
-    void setBarrierRatio(double bR);
-    void setStepRatio(double sR);
-    void setWalk(bool w);
+    double getPoint(int i) const { return sec[i]; }
+    size_t getMemoryUsage() const;
 private:
-    double secBarrier[2];
-    double secStepSize, priBarrier, priStepSize,
-        sumPeriod = 0.0, barrierRatio = 0.1, stepRatio = 0.01;
-    int distribution;
-    bool walk = true;
+    static const RandomWalkParams defaultParams;
+    const RandomWalkParams* params = &defaultParams;
+    bool useSharedBarriers = false;
+    double ownSecBarrier[2] = {-1.0, 1.0};
+    double sumPeriod = 0.0;
     std::vector<double> pri, sec;
 };
@@ -0,0 +1,177 @@
+/*
+  ==============================================================================
+
+    RealtimeGuard.cpp
+
+    Xenos: Xenharmonic Stochastic Synthesizer
+    Raphael Radna
+    This code is licensed under the GPLv3
+
+  ==============================================================================
+*/
+
+#include "RealtimeGuard.h"
+
+#if XENOS_RT_GUARD
+#include <juce_core/juce_core.h>
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#if JUCE_LINUX
+#include <dlfcn.h>
+#include <pthread.h>
+#endif
+
+namespace rt_guard
+{
+namespace
+{
+// plain thread locals, the hooks below can run before any constructor
+thread_local int realtimeDepth = 0;
+thread_local int allowDepth = 0;
+thread_local bool reporting = false;
+std::atomic<int> numViolations{0};
+} // namespace
+
+ScopedRealtimeContext::ScopedRealtimeContext() { ++realtimeDepth; }
+ScopedRealtimeContext::~ScopedRealtimeContext() { --realtimeDepth; }
+ScopedAllowViolations::ScopedAllowViolations() { ++allowDepth; }
+ScopedAllowViolations::~ScopedAllowViolations() { --allowDepth; }
+
+int getNumViolations() { return numViolations.load(); }
+void resetViolations() { numViolations.store(0); }
+
+// Reporting allocates and may lock too, which mustn't count again
+static void check(const char *what)
+{
+    if (realtimeDepth == 0 || allowDepth > 0 || reporting)
+        return;
+    reporting = true;
+    numViolations.fetch_add(1);
+    auto stack = juce::SystemStats::getStackBacktrace();
+    std::fprintf(stderr, "Real-time violation: %s\n%s\n", what, stack.toRawUTF8());
+    reporting = false;
+}
+} // namespace rt_guard
+
+void *operator new(std::size_t size)
+{
+    rt_guard::check("operator new");
+    if (void *p = std::malloc(size ? size : 1))
+        return p;
+    throw std::bad_alloc();
+}
+void *operator new[](std::size_t size) { return ::operator new(size); }
+void *operator new(std::size_t size, const std::nothrow_t &) noexcept
+{
+    rt_guard::check("operator new");
+    return std::malloc(size ? size : 1);
+}
+void *operator new[](std::size_t size, const std::nothrow_t &) noexcept
+{
+    return ::operator new(size, std::nothrow);
+}
+void operator delete(void *p) noexcept
+{
+    if (p)
+        rt_guard::check("operator delete");
+    std::free(p);
+}
+void operator delete[](void *p) noexcept { ::operator delete(p); }
+void operator delete(void *p, std::size_t) noexcept { ::operator delete(p); }
+void operator delete[](void *p, std::size_t) noexcept { ::operator delete(p); }
+void operator delete(void *p, const std::nothrow_t &) noexcept { ::operator delete(p); }
+void operator delete[](void *p, const std::nothrow_t &) noexcept { ::operator delete(p); }
+
+#if __cpp_aligned_new
+// For types aligned beyond the default, like the SIMD blocks. Windows has no aligned memory
+// that std::free can release, so it gets its own pair.
+static void *allocateAligned(std::size_t size, std::align_val_t alignment) noexcept
+{
+    size = size ? size : 1;
+#if JUCE_WINDOWS
+    return _aligned_malloc(size, (std::size_t)alignment);
+#else
+    void *p = nullptr;
+    const auto align = std::max((std::size_t)alignment, sizeof(void *));
+    return posix_memalign(&p, align, size) == 0 ? p : nullptr;
+#endif
+}
+static void freeAligned(void *p) noexcept
+{
+#if JUCE_WINDOWS
+    _aligned_free(p);
+#else
+    std::free(p);
+#endif
+}
+
+void *operator new(std::size_t size, std::align_val_t alignment)
+{
+    rt_guard::check("operator new");
+    if (void *p = allocateAligned(size, alignment))
+        return p;
+    throw std::bad_alloc();
+}
+void *operator new[](std::size_t size, std::align_val_t alignment)
+{
+    return ::operator new(size, alignment);
+}
+void *operator new(std::size_t size, std::align_val_t alignment, const std::nothrow_t &) noexcept
+{
+    rt_guard::check("operator new");
+    return allocateAligned(size, alignment);
+}
+void *operator new[](std::size_t size, std::align_val_t alignment,
+                     const std::nothrow_t &) noexcept
+{
+    return ::operator new(size, alignment, std::nothrow);
+}
+void operator delete(void *p, std::align_val_t) noexcept
+{
+    if (p)
+        rt_guard::check("operator delete");
+    freeAligned(p);
+}
+void operator delete[](void *p, std::align_val_t alignment) noexcept
+{
+    ::operator delete(p, alignment);
+}
+void operator delete(void *p, std::size_t, std::align_val_t alignment) noexcept
+{
+    ::operator delete(p, alignment);
+}
+void operator delete[](void *p, std::size_t, std::align_val_t alignment) noexcept
+{
+    ::operator delete(p, alignment);
+}
+void operator delete(void *p, std::align_val_t alignment, const std::nothrow_t &) noexcept
+{
+    ::operator delete(p, alignment);
+}
+void operator delete[](void *p, std::align_val_t alignment, const std::nothrow_t &) noexcept
+{
+    ::operator delete(p, alignment);
+}
+#endif
+
+#if JUCE_LINUX
+// std::mutex, juce::CriticalSection and juce::WaitableEvent all lock through this. The real
+// function is looked up on first use, without a static guard, which may itself lock.
+extern "C" int pthread_mutex_lock(pthread_mutex_t *mutex)
+{
+    using LockFn = int (*)(pthread_mutex_t *);
+    static std::atomic<LockFn> next{nullptr};
+    auto fn = next.load(std::memory_order_relaxed);
+    if (!fn)
+    {
+        fn = (LockFn)dlsym(RTLD_NEXT, "pthread_mutex_lock");
+        next.store(fn, std::memory_order_relaxed);
+    }
+    rt_guard::check("pthread_mutex_lock");
+    return fn(mutex);
+}
+#endif
+#endif
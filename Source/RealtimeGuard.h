@@ -0,0 +1,58 @@
+/*
+  ==============================================================================
+
+    RealtimeGuard.h
+
+    Xenos: Xenharmonic Stochastic Synthesizer
+    Raphael Radna
+    This code is licensed under the GPLv3
+
+  ==============================================================================
+*/
+
+#pragma once
+
+// Catches allocations and locks on the audio threads, in builds with XENOS_RT_GUARD (the
+// XENOS_RT_GUARD CMake option, which applies to Debug builds of the console test app). While a
+// thread is inside a ScopedRealtimeContext, every global operator new and delete and, on Linux,
+// every pthread_mutex_lock is a violation: it's reported on stderr with the call stack and
+// counted, so a test can fail when getNumViolations() isn't 0. Without XENOS_RT_GUARD the
+// classes are empty and cost nothing.
+// The replacements only take effect in an executable. A plugin loaded by a host keeps its
+// symbols to itself, so they'd never be called and the plugins aren't built with the guard.
+namespace rt_guard
+{
+#if XENOS_RT_GUARD
+class ScopedRealtimeContext
+{
+  public:
+    ScopedRealtimeContext();
+    ~ScopedRealtimeContext();
+};
+
+// For the known and accepted exceptions inside a real-time context
+class ScopedAllowViolations
+{
+  public:
+    ScopedAllowViolations();
+    ~ScopedAllowViolations();
+};
+
+int getNumViolations();
+void resetViolations();
+#else
+// the empty constructors and destructors keep unused variable warnings away from the scopes
+struct ScopedRealtimeContext
+{
+    ScopedRealtimeContext() {}
+    ~ScopedRealtimeContext() {}
+};
+struct ScopedAllowViolations
+{
+    ScopedAllowViolations() {}
+    ~ScopedAllowViolations() {}
+};
+inline int getNumViolations() { return 0; }
+inline void resetViolations() {}
+#endif
+} // namespace rt_guard
@@ -0,0 +1,81 @@
+/*
+  ==============================================================================
+
+    SRProvider.h
+
+    Xenos: Xenharmonic Stochastic Synthesizer
+    Raphael Radna
+    This code is licensed under the GPLv3
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+
+// Sample rate and envelope rate tables in the form the sst-basic-blocks modulators expect.
+// Shared by Xenos and VintageGranular.
+struct SRProvider
+{
+    static constexpr int BLOCK_SIZE = 32;
+    static constexpr int BLOCK_SIZE_OS = BLOCK_SIZE * 2;
+    SRProvider() { initTables(); }
+    alignas(32) float table_envrate_linear[512];
+    double samplerate = 44100.0;
+    void initTables()
+    {
+        double dsamplerate_os = samplerate * 2;
+        for (int i = 0; i < 512; ++i)
+        {
+            double k =
+                dsamplerate_os * pow(2.0, (((double)i - 256.0) / 16.0)) / (double)BLOCK_SIZE_OS;
+            table_envrate_linear[i] = (float)(1.f / k);
+        }
+    }
+    float envelope_rate_linear_nowrap(float x)
+    {
+        x *= 16.f;
+        x += 256.f;
+        int e = std::clamp<int>((int)x, 0, 0x1ff - 1);
+
+        float a = x - (float)e;
+
+        return (1 - a) * table_envrate_linear[e & 0x1ff] +
+               a * table_envrate_linear[(e + 1) & 0x1ff];
+    }
+};
+
+// Slices host buffers into control blocks of SRProvider::BLOCK_SIZE samples. The slicing carries
+// over from one host buffer to the next, so control blocks always start BLOCK_SIZE samples apart
+// and the control-rate work happens at the same samples whatever the host buffer sizes are.
+struct SubBlockScheduler
+{
+    void reset() { position = 0; }
+    // how far into the current control block the next sample is
+    int getPositionInBlock() const { return position; }
+
+    // Calls control() at the start of every control block and audio(offset, n) for the runs of
+    // samples in between, offset being relative to the start of the host buffer. audio returns
+    // false to skip the rest of the buffer.
+    template <typename ControlFn, typename AudioFn>
+    void process(int numSamples, ControlFn &&control, AudioFn &&audio)
+    {
+        int offset = 0;
+        while (offset < numSamples)
+        {
+            if (position == 0)
+                control();
+            const int n = std::min(numSamples - offset, SRProvider::BLOCK_SIZE - position);
+            const bool keepGoing = audio(offset, n);
+            position = (position + n) % SRProvider::BLOCK_SIZE;
+            offset += n;
+            if (!keepGoing)
+                break;
+        }
+    }
+
+  private:
+    int position = 0;
+};
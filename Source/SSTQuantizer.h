@@ -1,10 +1,61 @@
 #pragma once
 
 #include <JuceHeader.h>
+#include <array>
 #include "libMTSClient.h"
 #include "Tunings.h"
+#include "ScalaParser.h"
+#include "ScaleStore.h"
+#include "TuningCache.h"
+#include "AudioHandover.h"
+#include "TraceRecorder.h"
 
-#define SCALE_PRESETS (14)
+// Builds the tuning library objects straight from the shared Scala parser output, so the text
+// doesn't need to be parsed a second time by Tunings::parseSCLData/parseKBMData
+inline Tunings::Scale tuningsScaleFromScl(const scala::SclData &data, const std::string &rawText)
+{
+    Tunings::Scale result;
+    result.description = data.description;
+    result.rawText = rawText;
+    result.count = (int)data.tones.size();
+    result.tones.reserve(data.tones.size());
+    for (auto &t : data.tones)
+    {
+        Tunings::Tone tone;
+        if (t.type == scala::Tone::Cents)
+        {
+            tone.type = Tunings::Tone::kToneCents;
+        }
+        else
+        {
+            tone.type = Tunings::Tone::kToneRatio;
+            tone.ratio_n = t.numerator;
+            tone.ratio_d = t.denominator;
+        }
+        tone.cents = t.cents;
+        tone.floatValue = t.cents / 1200.0 + 1.0;
+        tone.stringRep = t.text;
+        result.tones.push_back(tone);
+    }
+    return result;
+}
+
+inline Tunings::KeyboardMapping keyboardMappingFromKbm(const scala::KbmData &data,
+                                                       const std::string &rawText)
+{
+    Tunings::KeyboardMapping result;
+    result.count = data.size;
+    result.firstMidi = data.firstNote;
+    result.lastMidi = data.lastNote;
+    result.middleNote = data.middleNote;
+    result.tuningConstantNote = data.referenceNote;
+    result.tuningFrequency = data.referenceFrequency;
+    result.tuningPitch = data.referenceFrequency / Tunings::MIDI_0_FREQ;
+    result.octaveDegrees = data.octaveDegree;
+    result.keys = data.keys;
+    result.rawText = rawText;
+    return result;
+}
 
 // Obviously this full looping over the frequency tables isn't ideal...
 // I guess we could fetch all the possible frequencies into a sorted vector/array
@@ -13,21 +64,22 @@
 // we should ideally respect that.
 // Another possibility would be to precalculate the lowest and highest index we need from
 // the frequency table based on the synthesis pitch center and width parameters.
+// If externalFrequencies isn't null, the 128 frequencies in it are used instead of the tuning.
 inline double findClosestFrequency(const Tunings::Tuning &tuning, double sourceFrequency,
-                                   MTSClient *mts)
+                                   const double *externalFrequencies)
 {
     double lastdiff = 10000000.0;
     double found = 0.0;
     int notesToScan = 256;
-    if (mts)
+    if (externalFrequencies)
         notesToScan = 128;
     for (int i = 0; i < notesToScan; ++i)
     {
         double hz = 0.0;
-        if (!mts)
+        if (!externalFrequencies)
             hz = tuning.frequencyForMidiNote(i);
         else
-            hz = MTS_NoteToFrequency(mts, i, -1);
+            hz = externalFrequencies[i];
         double diff = std::abs(hz - sourceFrequency);
         if (diff < lastdiff)
         {
@@ -40,67 +92,85 @@ inline double findClosestFrequency(const Tunings::Tuning &tuning, double sourceF
     return found;
 }
 
+// Source of tuning that overrides the scale, like an MTS-ESP master. The engine uses the
+// MTS-ESP client unless another source is set, which the test harness does to run without
+// a master installed.
+struct ExternalTuningSource
+{
+    virtual ~ExternalTuningSource() = default;
+    virtual bool isActive() = 0;
+    virtual double getFrequencyForMidiNote(int note) = 0;
+};
+
 struct Quantizer2
 {
     MTSClient *mts_client = nullptr;
-    Quantizer2()
+    Quantizer2() : tables(std::make_unique<TuningSet>())
     {
         mts_client = MTS_RegisterClient();
-        initScalePresets();
+        setKeyboardMapping(keyboardMapping);
+        applyPendingTuning();
     }
     ~Quantizer2() { MTS_DeregisterClient(mts_client); }
 
+    // Message thread, for display. Uses the latest published tables and the scale the parameter
+    // selects, so it doesn't wait for the audio thread to pick them up.
     double getHzForMidiNote(int note)
     {
         if (use_oddsound && mts_client && MTS_HasMaster(mts_client))
             return MTS_NoteToFrequency(mts_client, note, -1);
-        return tuning.frequencyForMidiNote(note);
+        return publishedSet->tunings[(size_t)getDisplayedScale()]->frequencyForMidiNote(note);
+    }
+    // the scale parameter, 0 for off and then the presets and the custom scale
+    void attachScaleParameter(const std::atomic<float> *value) { scaleParameter = value; }
+    // Any thread. The scale the parameter selects, or while it's off the last one selected.
+    int getDisplayedScale() const
+    {
+        const int value = scaleParameter ? (int)scaleParameter->load(std::memory_order_relaxed)
+                                         : 0;
+        if (value > 0)
+            return juce::jmin(value - 1, (int)SCALE_PRESETS);
+        return selectedScale.load(std::memory_order_relaxed);
     }
     bool use_oddsound = true;
-    static Tunings::Scale scaleFromRatios(std::vector<double> ratios)
+    // presets come from the process wide store, only the custom scale is kept per instance
+    juce::SharedResourcePointer<ScaleStore> scaleStore;
+    Tunings::Scale customScale = Tunings::evenDivisionOfCentsByM(1200.0f, 12);
+    const Tunings::Scale &getScale(int index) const
+    {
+        if (index < SCALE_PRESETS)
+            return scaleStore->getTuningsPreset(index);
+        return customScale;
+    }
+    // Message thread. Compiles the custom scale, selected with the index SCALE_PRESETS after
+    // the presets, with the current keyboard mapping. The presets' tables are kept.
+    juce::String setCustomScale(const scala::SclData &data, const std::string &rawText)
     {
         try
         {
-            std::stringstream ss;
-            ss << "! Xenos preset\n";
-            ss << "!\n";
-            ss << "Xenos preset\n";
-            ss << ratios.size() << "\n";
-            ss << "!\n";
-            char buf[100];
-            for (auto &ratio : ratios)
-            {
-                double cents = 1200.0 * std::log2(ratio);
-                // because of how the Scala format works we need floating point cents
-                // always with the decimal point, so can't stream the float directly
-                sprintf_s(buf, "%f", cents);
-                ss << buf << "\n";
-            }
-            auto str = ss.str();
-            return Tunings::parseSCLData(str);
+            auto scale = tuningsScaleFromScl(data, rawText);
+            auto set = std::make_unique<TuningSet>(*publishedSet);
+            set->tunings[SCALE_PRESETS] = tuningCache->get(scale, keyboardMapping);
+            customScale = scale;
+            publish(std::move(set));
+            return "";
         }
-        catch (const std::exception &e)
+        catch (std::exception &ex)
         {
-            DBG(e.what());
+            return ex.what();
         }
-        return Tunings::evenTemperament12NoteScale();
-    }
-    std::vector<Tunings::Scale> scalePresets;
-    void setScale(int index, Tunings::KeyboardMapping &kbm)
-    {
-        jassert(index >= 0 && index < scalePresets.size());
-        auto &scale = scalePresets[index];
-        // auto kbm = Tunings::startScaleOnAndTuneNoteTo(0, 69, 440.0);
-        tuning = Tunings::Tuning(scale, kbm);
+        return "";
     }
-    juce::String loadScalaFile(juce::File fn, Tunings::KeyboardMapping &kbm)
+    // Message thread. Retunes the presets and the custom scale with a new keyboard mapping.
+    juce::String setKeyboardMapping(const Tunings::KeyboardMapping &kbm)
     {
-        auto str = fn.getFullPathName().toStdString();
         try
         {
-            auto scale = Tunings::readSCLFile(str);
-            scalePresets.back() = scale;
-            tuning = Tunings::Tuning(scale, kbm);
+            auto set = std::make_unique<TuningSet>();
+            for (int i = 0; i <= SCALE_PRESETS; ++i)
+                set->tunings[(size_t)i] = tuningCache->get(getScale(i), kbm);
+            keyboardMapping = kbm;
+            publish(std::move(set));
             return "";
         }
         catch (std::exception &ex)
@@ -109,53 +179,121 @@ struct Quantizer2
         }
         return "";
     }
-    void initScalePresets()
-    {
-        scalePresets.clear();
-        scalePresets.push_back(
-            scaleFromRatios({1.122462, 1.259921, 1.498307, 1.681793, 2.0})); // pentatonic
-        scalePresets.push_back(
-            scaleFromRatios({1.125, 1.265625, 1.5, 1.6875, 2.0})); // pentatonic (pythagorean)
-        scalePresets.push_back(
-            scaleFromRatios({1.189207, 1.33484, 1.414214, 1.498307, 1.781797, 2.0})); // blues
-
-        scalePresets.push_back(
-            scaleFromRatios({1.166667, 1.333333, 1.4, 1.5, 1.75, 2.0})); // blues (7-limit)
-        scalePresets.push_back(
-            scaleFromRatios({1.122462, 1.259921, 1.414214, 1.587401, 1.781797, 2.0})); // whole tone
-        scalePresets.push_back(scaleFromRatios(
-            {1.122462, 1.259921, 1.33484, 1.498307, 1.681793, 1.887749, 2.0})); // major
-        scalePresets.push_back(
-            scaleFromRatios({1.125, 1.25, 1.333333, 1.5, 1.666667, 1.875, 2.0})); // major 5limit
-        scalePresets.push_back(scaleFromRatios(
-            {1.122462, 1.189207, 1.33484, 1.498307, 1.587401, 1.781797, 2.0})); // minor
-        scalePresets.push_back(
-            scaleFromRatios({1.125, 1.2, 1.333333, 1.5, 1.6, 1.777778, 2.0})); // minor 5limit
-        scalePresets.push_back(scaleFromRatios({1., 1.122462, 1.189207, 1.33484, 1.414214, 1.587401,
-                                                1.681793, 1.887749, 2.0})); // octatonic
-        scalePresets.push_back(
-            scaleFromRatios({1.125, 1.25, 1.375, 1.5, 1.625, 1.75, 1.875, 2.0})); // overtone
-        scalePresets.push_back(Tunings::evenTemperament12NoteScale());            // chromatic
-        scalePresets.push_back(scaleFromRatios({1.088182, 1.18414, 1.288561, 1.402189, 1.525837,
-                                                1.660388, 1.806806, 1.966134, 2.139512, 2.328178,
-                                                2.533484, 2.756892, 3.0}));   // bohlen-pierce
-        scalePresets.push_back(Tunings::evenDivisionOfCentsByM(1200.0f, 24)); // quarter-tone
-        scalePresets.push_back(Tunings::evenDivisionOfCentsByM(
-            1200.0f, 12)); // 12edo placeholder for custom Scala file
-        jassert(scalePresets.size() == SCALE_PRESETS + 1);
-    }
     double quantizeHz(double sourceHz)
     {
         if (!active)
             return sourceHz;
-        MTSClient *temp = nullptr;
-        if (use_oddsound && mts_client && MTS_HasMaster(mts_client))
-            temp = mts_client;
-        double hz = findClosestFrequency(tuning, sourceHz, temp);
+        XENOS_TRACE_SCOPE("Quantizer2::quantizeHz");
+        double hz =
+            findClosestFrequency(getTuning(), sourceHz, externalActive ? externalHz : nullptr);
         if (hz > 0.0)
             return hz;
         return sourceHz;
     }
+    // only changed by the audio thread, through XenosSynthHolder::selectScale
     bool active = false;
-    Tunings::Tuning tuning;
+
+    // The external tuning is polled once per block by the audio thread instead of every voice
+    // querying the MTS-ESP client on its own. Each note gets a new version number only when its
+    // frequency actually changes, so a voice can tell in O(1) whether it needs retuning.
+    ExternalTuningSource *externalSource = nullptr;
+    // returns true if any note was retuned or the external tuning was switched on or off
+    bool updateExternalTuning()
+    {
+        bool isActive = false;
+        if (externalSource)
+            isActive = externalSource->isActive();
+        else
+            isActive = use_oddsound && mts_client && MTS_HasMaster(mts_client);
+        bool changed = false;
+        if (isActive != externalActive)
+        {
+            externalActive = isActive;
+            for (auto &v : noteVersions)
+                ++v;
+            changed = true;
+        }
+        if (!isActive)
+        {
+            if (changed)
+                tuningVersion.fetch_add(1, std::memory_order_relaxed);
+            return changed;
+        }
+        for (int i = 0; i < 128; ++i)
+        {
+            double hz = externalSource ? externalSource->getFrequencyForMidiNote(i)
+                                       : MTS_NoteToFrequency(mts_client, i, -1);
+            if (hz != externalHz[i])
+            {
+                externalHz[i] = hz;
+                // same as MTS_RetuningInSemitones
+                double equalTempered = 440.0 * std::pow(2.0, (i - 69) / 12.0);
+                externalRetuning[i] = 12.0 * std::log2(hz / equalTempered);
+                ++noteVersions[i];
+                changed = true;
+            }
+        }
+        if (changed)
+            tuningVersion.fetch_add(1, std::memory_order_relaxed);
+        return changed;
+    }
+    bool isExternalTuningActive() const { return externalActive; }
+    double getExternalRetuningInSemitones(int note) const { return externalRetuning[note]; }
+    double getExternalHz(int note) const { return externalHz[note]; }
+    unsigned int getNoteVersion(int note) const { return noteVersions[note]; }
+    // Changes whenever the tuning or the external tuning does, may be read from any thread
+    unsigned int getTuningVersion() const { return tuningVersion.load(std::memory_order_relaxed); }
+
+    // The compiled tables come from the process wide cache. Every scale has its table compiled
+    // up front for the current keyboard mapping, so the audio thread switches scales by
+    // pointer. A new set of tables is only built on the message thread, for a new mapping or
+    // custom scale, and handed to the audio thread, which switches to it at the start of its
+    // next block and hands the old one back to be released on the message thread, so no lookup
+    // can be using a table that's freed. Until then getTuning() returns the old table.
+    juce::SharedResourcePointer<TuningCache> tuningCache;
+    // audio thread
+    const Tunings::Tuning &getTuning() const { return *tuning.load(std::memory_order_acquire); }
+    void selectScale(int index)
+    {
+        jassert(index >= 0 && index <= SCALE_PRESETS);
+        selectedScale.store(index, std::memory_order_relaxed);
+        tuning.store(tables.getCurrent().tunings[(size_t)index].get(), std::memory_order_release);
+        tuningVersion.fetch_add(1, std::memory_order_relaxed);
+    }
+    // message thread, releases the tables the audio thread has handed back
+    void releaseRetiredTunings() { tables.collectRetired(); }
+    // Audio thread, at the start of every block before any lookup
+    void applyPendingTuning()
+    {
+        if (tables.acquire())
+            selectScale(selectedScale.load(std::memory_order_relaxed));
+    }
+
+  private:
+    struct TuningSet
+    {
+        // the presets, then the custom scale
+        std::array<TuningCache::TuningPtr, SCALE_PRESETS + 1> tunings;
+    };
+    // message thread
+    void publish(std::unique_ptr<TuningSet> set)
+    {
+        publishedSet = set.get();
+        tables.publish(std::move(set));
+        tuningVersion.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    bool externalActive = false;
+    double externalHz[128] = {};
+    double externalRetuning[128] = {};
+    unsigned int noteVersions[128] = {};
+    std::atomic<unsigned int> tuningVersion{0};
+
+    AudioHandover<TuningSet> tables;
+    // the latest set handed over, message thread only
+    const TuningSet *publishedSet = nullptr;
+    Tunings::KeyboardMapping keyboardMapping = Tunings::startScaleOnAndTuneNoteTo(69, 69, 440.0);
+    std::atomic<const Tunings::Tuning *> tuning{nullptr};
+    std::atomic<int> selectedScale{0};
+    const std::atomic<float> *scaleParameter = nullptr;
 };
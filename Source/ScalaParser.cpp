@@ -0,0 +1,282 @@
+/*
+  ==============================================================================
+
+    ScalaParser.cpp
+
+    Xenos: Xenharmonic Stochastic Synthesizer
+    Raphael Radna
+    This code is licensed under the GPLv3
+
+  ==============================================================================
+*/
+
+#include <cmath>
+#include "ScalaParser.h"
+
+namespace scala
+{
+
+namespace
+{
+inline bool isSpace(char c) { return c == ' ' || c == '\t' || c == '\r' || c == '\f'; }
+inline bool isDigit(char c) { return c >= '0' && c <= '9'; }
+
+const char *skipSpace(const char *p, const char *e)
+{
+    while (p < e && isSpace(*p))
+        ++p;
+    return p;
+}
+
+// Walks the text one line at a time, skipping the "!" comment lines of the Scala formats
+struct LineReader
+{
+    LineReader(const std::string &text) : pos(text.data()), end(text.data() + text.size()) {}
+    bool next(const char *&lineBegin, const char *&lineEnd)
+    {
+        while (pos < end)
+        {
+            lineBegin = pos;
+            while (pos < end && *pos != '\n')
+                ++pos;
+            lineEnd = pos;
+            if (pos < end)
+                ++pos; // skip the newline
+            ++lineNumber;
+            if (lineEnd > lineBegin && lineEnd[-1] == '\r')
+                --lineEnd;
+            if (lineBegin < lineEnd && *lineBegin == '!')
+                continue;
+            return true;
+        }
+        return false;
+    }
+    bool nextNonEmpty(const char *&lineBegin, const char *&lineEnd)
+    {
+        while (next(lineBegin, lineEnd))
+        {
+            if (skipSpace(lineBegin, lineEnd) != lineEnd)
+                return true;
+        }
+        return false;
+    }
+    const char *pos;
+    const char *end;
+    int lineNumber = 0;
+};
+
+bool parseInteger(const char *&p, const char *e, long long &value)
+{
+    bool negative = false;
+    if (p < e && (*p == '-' || *p == '+'))
+    {
+        negative = *p == '-';
+        ++p;
+    }
+    if (p == e || !isDigit(*p))
+        return false;
+    long long v = 0;
+    while (p < e && isDigit(*p))
+    {
+        v = v * 10 + (*p - '0');
+        if (v > 1000000000000000LL)
+            return false;
+        ++p;
+    }
+    value = negative ? -v : v;
+    return true;
+}
+
+// Locale independent, unlike strtod which may expect a decimal comma
+bool parseDecimal(const char *&p, const char *e, double &value)
+{
+    bool negative = false;
+    if (p < e && (*p == '-' || *p == '+'))
+    {
+        negative = *p == '-';
+        ++p;
+    }
+    bool hasDigits = false;
+    double v = 0.0;
+    while (p < e && isDigit(*p))
+    {
+        v = v * 10.0 + (*p - '0');
+        hasDigits = true;
+        ++p;
+    }
+    if (p < e && *p == '.')
+    {
+        ++p;
+        double scaler = 0.1;
+        while (p < e && isDigit(*p))
+        {
+            v += (*p - '0') * scaler;
+            scaler *= 0.1;
+            hasDigits = true;
+            ++p;
+        }
+    }
+    if (!hasDigits)
+        return false;
+    if (p < e && (*p == 'e' || *p == 'E'))
+    {
+        const char *expStart = p + 1;
+        long long exponent = 0;
+        if (parseInteger(expStart, e, exponent))
+        {
+            v *= std::pow(10.0, (double)exponent);
+            p = expStart;
+        }
+    }
+    value = negative ? -v : v;
+    return true;
+}
+
+bool parseIntegerLine(const char *b, const char *e, int &value)
+{
+    b = skipSpace(b, e);
+    long long v = 0;
+    if (!parseInteger(b, e, v))
+        return false;
+    value = (int)v;
+    return true;
+}
+
+std::string lineError(const char *what, int lineNumber)
+{
+    return std::string(what) + " on line " + std::to_string(lineNumber);
+}
+
+std::string parseTone(const char *b, const char *e, Tone &tone)
+{
+    b = skipSpace(b, e);
+    const char *valueEnd = b;
+    while (valueEnd < e && !isSpace(*valueEnd))
+        ++valueEnd;
+    bool isCents = false;
+    for (const char *p = b; p < valueEnd; ++p)
+    {
+        if (*p == '.')
+        {
+            isCents = true;
+            break;
+        }
+    }
+    tone.text.assign(b, valueEnd);
+    if (isCents)
+    {
+        double cents = 0.0;
+        if (!parseDecimal(b, e, cents))
+            return "invalid cents value";
+        tone.type = Tone::Cents;
+        tone.cents = cents;
+        tone.numerator = 1;
+        tone.denominator = 1;
+        return "";
+    }
+    long long num = 0;
+    long long den = 1;
+    if (!parseInteger(b, e, num))
+        return "invalid ratio";
+    if (b < e && *b == '/')
+    {
+        ++b;
+        if (!parseInteger(b, e, den))
+            return "invalid ratio denominator";
+    }
+    if (num <= 0 || den <= 0)
+        return "ratio must be positive";
+    tone.type = Tone::Ratio;
+    tone.numerator = num;
+    tone.denominator = den;
+    tone.cents = 1200.0 * std::log2((double)num / (double)den);
+    return "";
+}
+} // namespace
+
+double Tone::getRatio() const
+{
+    if (type == Ratio)
+        return (double)numerator / (double)denominator;
+    return std::pow(2.0, cents / 1200.0);
+}
+
+double SclData::getPeriodCents() const
+{
+    if (tones.empty())
+        return 1200.0;
+    return tones.back().cents;
+}
+
+std::string parseScl(const std::string &text, SclData &result)
+{
+    result.description.clear();
+    result.tones.clear();
+    LineReader reader(text);
+    const char *b = nullptr;
+    const char *e = nullptr;
+    // the description line may be empty, so it's the only one that isn't skipped when blank
+    if (!reader.next(b, e))
+        return "missing description line";
+    result.description.assign(skipSpace(b, e), e);
+    if (!reader.nextNonEmpty(b, e))
+        return "missing note count";
+    int count = 0;
+    if (!parseIntegerLine(b, e, count) || count <= 0)
+        return lineError("invalid note count", reader.lineNumber);
+    result.tones.reserve(count);
+    for (int i = 0; i < count; ++i)
+    {
+        if (!reader.nextNonEmpty(b, e))
+            return "expected " + std::to_string(count) + " notes but found " + std::to_string(i);
+        Tone tone;
+        auto err = parseTone(b, e, tone);
+        if (!err.empty())
+            return lineError(err.c_str(), reader.lineNumber);
+        result.tones.push_back(std::move(tone));
+    }
+    return "";
+}
+
+std::string parseKbm(const std::string &text, KbmData &result)
+{
+    result = KbmData();
+    LineReader reader(text);
+    const char *b = nullptr;
+    const char *e = nullptr;
+    int *headerInts[] = {&result.size, &result.firstNote, &result.lastNote, &result.middleNote,
+                         &result.referenceNote};
+    for (auto *target : headerInts)
+    {
+        if (!reader.nextNonEmpty(b, e))
+            return "incomplete keyboard mapping header";
+        if (!parseIntegerLine(b, e, *target))
+            return lineError("invalid integer", reader.lineNumber);
+    }
+    if (!reader.nextNonEmpty(b, e))
+        return "missing reference frequency";
+    b = skipSpace(b, e);
+    if (!parseDecimal(b, e, result.referenceFrequency) || result.referenceFrequency <= 0.0)
+        return lineError("invalid reference frequency", reader.lineNumber);
+    if (!reader.nextNonEmpty(b, e))
+        return "missing octave degree";
+    if (!parseIntegerLine(b, e, result.octaveDegree))
+        return lineError("invalid octave degree", reader.lineNumber);
+    if (result.size < 0)
+        return "invalid keyboard mapping size";
+    // mapping entries left out at the end of the file are treated as unmapped
+    result.keys.assign(result.size, -1);
+    for (int i = 0; i < result.size; ++i)
+    {
+        if (!reader.nextNonEmpty(b, e))
+            break;
+        b = skipSpace(b, e);
+        if (*b == 'x' || *b == 'X')
+            continue;
+        if (!parseIntegerLine(b, e, result.keys[i]))
+            return lineError("invalid key mapping", reader.lineNumber);
+    }
+    return "";
+}
+
+} // namespace scala
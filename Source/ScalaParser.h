@@ -0,0 +1,65 @@
+/*
+  ==============================================================================
+
+    ScalaParser.h
+
+    Xenos: Xenharmonic Stochastic Synthesizer
+    Raphael Radna
+    This code is licensed under the GPLv3
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+// Single pass parser for the Scala .scl and .kbm formats. Doesn't depend on JUCE or the
+// tuning library, so the same parsed data can be turned into the Xenos Scale used by
+// Quantizer and into the Tunings::Scale used by Quantizer2 without parsing the text twice.
+namespace scala
+{
+
+struct Tone
+{
+    enum Type
+    {
+        Cents,
+        Ratio
+    };
+    Type type = Ratio;
+    double cents = 0.0;
+    long long numerator = 1;
+    long long denominator = 1;
+    std::string text; // the pitch value as it appeared in the file
+
+    double getRatio() const;
+};
+
+struct SclData
+{
+    std::string description;
+    // doesn't include the implicit 1/1, the last tone is the period of the scale
+    std::vector<Tone> tones;
+
+    double getPeriodCents() const;
+};
+
+struct KbmData
+{
+    int size = 0;
+    int firstNote = 0;
+    int lastNote = 127;
+    int middleNote = 60;
+    int referenceNote = 69;
+    double referenceFrequency = 440.0;
+    int octaveDegree = 0;
+    std::vector<int> keys; // -1 for unmapped keys
+};
+
+// The parse functions return an empty string on success and an error message otherwise
+std::string parseScl(const std::string &text, SclData &result);
+std::string parseKbm(const std::string &text, KbmData &result);
+
+} // namespace scala
@@ -10,9 +10,7 @@
   ==============================================================================
 */
 
-#include <regex>
 #include "Scale.h"
-#include "Utility.h"
 
 Scale::Scale()
 {
@@ -29,48 +27,26 @@ Scale::Scale(std::vector<double> _intervals, double _repeatPoint)
 
 Scale::Scale(juce::StringArray scalaLines)
 {
-    for (int i = 0; i < scalaLines.size(); i++) {
-        std::smatch match;
-        std::string str = scalaLines[i].toStdString();
-        if (std::regex_search(
-                str, match,
-                std::regex("^\\s*\\d+((\\.\\d*)|(\\/\\d+))?(\\s*cents)?")))
-            intervals.push_back(parseSclLine(str));
-    }
-    intervals.erase(intervals.begin()); // remove cardinality
-
-    if (intervals[0] == 1) {
-        repeatRatio = 2;
-    } else {
-        repeatRatio = intervals.back();
-        intervals.pop_back();
-        intervals.insert(intervals.begin(), 1);
-    }
+    scala::SclData data;
+    if (scala::parseScl(scalaLines.joinIntoString("\n").toStdString(), data).empty())
+        *this = Scale(data);
+    else
+        *this = Scale();
 }
 
-double Scale::parseSclLine(std::string str)
+Scale::Scale(const scala::SclData &data)
 {
-    std::smatch match;
-    double interval = 1;
-    if (std::regex_search(str, match,
-                          std::regex("^\\s*(\\d+)\\/(\\d+)"))) { // ratio
-        interval = stod(match[1]) / stod(match[2]);
-    } else if (std::regex_search(
-                   str, match,
-                   std::regex("^\\s*(\\d+\\.\\d*)\\s*cents"))) { // cents
-        interval = ctor(stod(match[1]));
-    } else if (std::regex_search(str, match,
-                                 std::regex("^\\s*\\d+\\.\\d*"))) { // decimal
-        interval = ctor(stod(match[0]));
-    } else if (std::regex_search(str, match,
-                                 std::regex("^\\s*(\\d+)"))) { // integer
-        interval = stoi(match[1]);
-    }
-    return interval;
+    intervals.reserve(data.tones.size());
+    intervals.push_back(1);
+    for (size_t i = 0; i + 1 < data.tones.size(); i++)
+        intervals.push_back(data.tones[i].getRatio());
+    repeatRatio = data.tones.empty() ? 2 : data.tones.back().getRatio();
 }
 
-unsigned long Scale::size() { return intervals.size(); }
+unsigned long Scale::size() const { return intervals.size(); }
+
+double Scale::getInterval(int i) const { return intervals[i]; }
 
-double Scale::getInterval(int i) { return intervals[i]; }
+double Scale::getRepeatRatio() const { return repeatRatio; }
 
-double Scale::getRepeatRatio() { return repeatRatio; }
+size_t Scale::getMemoryUsage() const { return intervals.capacity() * sizeof(double); }
@@ -13,17 +13,19 @@
 #pragma once
 
 #include <JuceHeader.h>
+#include "ScalaParser.h"
 
 class Scale {
 public:
     Scale();
     Scale(std::vector<double> _intervals, double _repeatPoint);
     Scale(juce::StringArray scalaLines);
+    Scale(const scala::SclData &data);
 
-    double parseSclLine(std::string str);
-    unsigned long size();
-    double getInterval(int i);
-    double getRepeatRatio();
+    unsigned long size() const;
+    double getInterval(int i) const;
+    double getRepeatRatio() const;
+    size_t getMemoryUsage() const;
 private:
     std::vector<double> intervals;
     double repeatRatio;
@@ -0,0 +1,175 @@
+/*
+  ==============================================================================
+
+    ScaleLibrary.cpp
+
+    Xenos: Xenharmonic Stochastic Synthesizer
+    Raphael Radna
+    This code is licensed under the GPLv3
+
+  ==============================================================================
+*/
+
+#include <map>
+#include "ScaleLibrary.h"
+
+ScaleLibrary::ScaleLibrary()
+    : ScaleLibrary(juce::File::getSpecialLocation(juce::File::userApplicationDataDirectory)
+                       .getChildFile("Xenos")
+                       .getChildFile("Scales"),
+                   juce::File::getSpecialLocation(juce::File::userApplicationDataDirectory)
+                       .getChildFile("Xenos")
+                       .getChildFile("scalelibrary.cache"))
+{
+}
+
+ScaleLibrary::ScaleLibrary(juce::File rootDirectory, juce::File cacheFile)
+    : juce::Thread("Scale library scan"), root(rootDirectory), cache(cacheFile),
+      entries(std::make_shared<const Entries>())
+{
+}
+
+ScaleLibrary::~ScaleLibrary() { stopThread(4000); }
+
+void ScaleLibrary::refreshAsync()
+{
+    refreshing = true;
+    if (isThreadRunning())
+        notify();
+    else
+        startThread();
+}
+
+void ScaleLibrary::run()
+{
+    while (!threadShouldExit())
+    {
+        refreshing = true;
+        refresh();
+        refreshing = false;
+        wait(-1);
+    }
+}
+
+std::shared_ptr<const ScaleLibrary::Entries> ScaleLibrary::getEntries() const
+{
+    const juce::ScopedLock sl(entriesLock);
+    return entries;
+}
+
+int ScaleLibrary::refresh()
+{
+    if (!cacheLoaded)
+    {
+        if (auto cached = readCache())
+        {
+            const juce::ScopedLock sl(entriesLock);
+            entries = cached;
+        }
+        cacheLoaded = true;
+    }
+    const auto previous = getEntries();
+    std::map<juce::String, size_t> cachedIndices;
+    for (size_t i = 0; i < previous->size(); ++i)
+        cachedIndices[(*previous)[i].relativePath] = i;
+
+    Entries updated;
+    updated.reserve(previous->size());
+    int numParsed = 0;
+    if (root.isDirectory())
+    {
+        for (auto &dirEntry :
+             juce::RangedDirectoryIterator(root, true, "*.scl", juce::File::findFiles))
+        {
+            // an unfinished scan leaves the catalogue as it was
+            if (juce::Thread::currentThreadShouldExit())
+                return numParsed;
+            Entry e;
+            e.relativePath = dirEntry.getFile().getRelativePathFrom(root);
+            e.modificationTime = dirEntry.getModificationTime().toMilliseconds();
+            e.fileSize = dirEntry.getFileSize();
+            auto it = cachedIndices.find(e.relativePath);
+            if (it != cachedIndices.end())
+            {
+                auto &cached = (*previous)[it->second];
+                if (cached.modificationTime == e.modificationTime && cached.fileSize == e.fileSize)
+                {
+                    updated.push_back(cached);
+                    continue;
+                }
+            }
+            scala::SclData data;
+            ++numParsed;
+            if (!scala::parseScl(dirEntry.getFile().loadFileAsString().toStdString(), data).empty())
+                continue;
+            e.description = juce::String(data.description);
+            e.numTones = (int)data.tones.size();
+            e.periodCents = (float)data.getPeriodCents();
+            updated.push_back(e);
+        }
+    }
+    std::sort(updated.begin(), updated.end(), [](const Entry &a, const Entry &b) {
+        return a.relativePath.compareNatural(b.relativePath) < 0;
+    });
+    bool changed = numParsed > 0 || updated.size() != previous->size();
+    auto result = std::make_shared<const Entries>(std::move(updated));
+    {
+        const juce::ScopedLock sl(entriesLock);
+        entries = result;
+    }
+    if (changed)
+        writeCache(*result);
+    return numParsed;
+}
+
+std::shared_ptr<const ScaleLibrary::Entries> ScaleLibrary::readCache() const
+{
+    juce::MemoryBlock block;
+    if (!cache.existsAsFile() || !cache.loadFileAsData(block))
+        return nullptr;
+    juce::MemoryInputStream in(block, false);
+    if (in.readInt() != cacheMagic || in.readInt() != cacheVersion)
+        return nullptr;
+    // a cache written for another directory is of no use
+    if (in.readString() != root.getFullPathName())
+        return nullptr;
+    int numEntries = in.readInt();
+    if (numEntries < 0)
+        return nullptr;
+    Entries result;
+    result.reserve(numEntries);
+    for (int i = 0; i < numEntries && !in.isExhausted(); ++i)
+    {
+        Entry e;
+        e.relativePath = in.readString();
+        e.description = in.readString();
+        e.numTones = in.readInt();
+        e.periodCents = in.readFloat();
+        e.modificationTime = in.readInt64();
+        e.fileSize = in.readInt64();
+        result.push_back(e);
+    }
+    if ((int)result.size() != numEntries)
+        return nullptr;
+    return std::make_shared<const Entries>(std::move(result));
+}
+
+void ScaleLibrary::writeCache(const Entries &toWrite) const
+{
+    juce::MemoryOutputStream out;
+    out.writeInt(cacheMagic);
+    out.writeInt(cacheVersion);
+    out.writeString(root.getFullPathName());
+    out.writeInt((int)toWrite.size());
+    for (auto &e : toWrite)
+    {
+        out.writeString(e.relativePath);
+        out.writeString(e.description);
+        out.writeInt(e.numTones);
+        out.writeFloat(e.periodCents);
+        out.writeInt64(e.modificationTime);
+        out.writeInt64(e.fileSize);
+    }
+    cache.getParentDirectory().createDirectory();
+    cache.replaceWithData(out.getData(), out.getDataSize());
+}
@@ -0,0 +1,78 @@
+/*
+  ==============================================================================
+
+    ScaleLibrary.h
+
+    Xenos: Xenharmonic Stochastic Synthesizer
+    Raphael Radna
+    This code is licensed under the GPLv3
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+#include <atomic>
+#include <memory>
+#include "ScalaParser.h"
+
+// Catalogue of the .scl files found under a directory. The catalogue is cached in a compact
+// binary file, so browsing a large library only needs the files to be stat'ed, and only new or
+// modified files get parsed again. Shared between editor instances through
+// juce::SharedResourcePointer<ScaleLibrary>.
+//
+// Even stat'ing thousands of files takes too long for the message thread, so the editor has the
+// catalogue refreshed on a background thread with refreshAsync() and shows the entries it has
+// so far. They're replaced as a whole when a scan completes.
+class ScaleLibrary : private juce::Thread
+{
+  public:
+    struct Entry
+    {
+        juce::String relativePath;
+        juce::String description;
+        int numTones = 0;
+        float periodCents = 1200.0f;
+        juce::int64 modificationTime = 0;
+        juce::int64 fileSize = 0;
+    };
+
+    // uses the default library location in the user application data directory
+    ScaleLibrary();
+    ScaleLibrary(juce::File rootDirectory, juce::File cacheFile);
+    ~ScaleLibrary() override;
+
+    // Brings the catalogue up to date with the directory contents and writes the cache if
+    // anything changed. Returns the number of files that had to be parsed. Blocks until done,
+    // and mustn't run while an asynchronous refresh does.
+    int refresh();
+    // Starts a refresh on the background thread, or another one after the running one
+    void refreshAsync();
+    bool isRefreshing() const { return refreshing.load(); }
+
+    using Entries = std::vector<Entry>;
+    // the catalogue as of the last completed refresh, any thread
+    std::shared_ptr<const Entries> getEntries() const;
+    bool isEmpty() const { return getEntries()->empty(); }
+    juce::File getRootDirectory() const { return root; }
+    juce::File getFile(const Entry &e) const { return root.getChildFile(e.relativePath); }
+
+  private:
+    void run() override;
+    std::shared_ptr<const Entries> readCache() const;
+    void writeCache(const Entries &toWrite) const;
+
+    juce::File root;
+    juce::File cache;
+    mutable juce::CriticalSection entriesLock;
+    std::shared_ptr<const Entries> entries;
+    // only used by the refreshing thread
+    bool cacheLoaded = false;
+    std::atomic<bool> refreshing{false};
+
+    static constexpr int cacheMagic = 0x434c5358; // "XSLC"
+    static constexpr int cacheVersion = 1;
+
+    JUCE_DECLARE_NON_COPYABLE(ScaleLibrary)
+};
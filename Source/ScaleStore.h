@@ -0,0 +1,40 @@
+/*
+  ==============================================================================
+
+    ScaleStore.h
+
+    Xenos: Xenharmonic Stochastic Synthesizer
+    Raphael Radna
+    This code is licensed under the GPLv3
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+#include "Scale.h"
+#include "Tunings.h"
+
+#define SCALE_PRESETS (14)
+
+// The preset scales, built once and shared by all voices of all Xenos instances in the process
+// through juce::SharedResourcePointer<ScaleStore>. Nothing here changes after construction, so
+// voices can hold plain pointers to the scales.
+class ScaleStore
+{
+  public:
+    ScaleStore();
+
+    const Scale &getPreset(int index) const;
+    const Tunings::Scale &getTuningsPreset(int index) const;
+    size_t getMemoryUsage() const;
+
+    static Tunings::Scale scaleFromRatios(const std::vector<double> &ratios);
+
+  private:
+    std::array<Scale, SCALE_PRESETS> presets;
+    std::array<Tunings::Scale, SCALE_PRESETS> tuningsPresets;
+
+    JUCE_DECLARE_NON_COPYABLE(ScaleStore)
+};
@@ -0,0 +1,212 @@
+/*
+  ==============================================================================
+
+    StateChunk.cpp
+
+    Xenos: Xenharmonic Stochastic Synthesizer
+    Raphael Radna
+    This code is licensed under the GPLv3
+
+  ==============================================================================
+*/
+
+#include "StateChunk.h"
+
+namespace
+{
+// counts read back are checked against these, so corrupt data can't make us allocate wildly
+constexpr int maxParams = 1024;
+constexpr int maxTones = 4096;
+constexpr int maxKeys = 4096;
+
+void writeString(juce::MemoryOutputStream &out, const std::string &s)
+{
+    out.writeCompressedInt((int)s.size());
+    out.write(s.data(), s.size());
+}
+
+bool readString(juce::MemoryInputStream &in, std::string &s)
+{
+    const int size = in.readCompressedInt();
+    if (size < 0 || size > in.getNumBytesRemaining())
+        return false;
+    s.resize((size_t)size);
+    return in.read(s.data(), size) == size;
+}
+
+void writeScl(juce::MemoryOutputStream &out, const scala::SclData &scl)
+{
+    writeString(out, scl.description);
+    out.writeCompressedInt((int)scl.tones.size());
+    for (auto &tone : scl.tones)
+    {
+        out.writeByte((char)tone.type);
+        out.writeDouble(tone.cents);
+        out.writeInt64(tone.numerator);
+        out.writeInt64(tone.denominator);
+        writeString(out, tone.text);
+    }
+}
+
+bool readScl(juce::MemoryInputStream &in, scala::SclData &scl)
+{
+    if (!readString(in, scl.description))
+        return false;
+    const int numTones = in.readCompressedInt();
+    if (numTones < 0 || numTones > maxTones)
+        return false;
+    scl.tones.resize((size_t)numTones);
+    for (auto &tone : scl.tones)
+    {
+        tone.type = in.readByte() == scala::Tone::Cents ? scala::Tone::Cents : scala::Tone::Ratio;
+        tone.cents = in.readDouble();
+        tone.numerator = in.readInt64();
+        tone.denominator = in.readInt64();
+        if (!readString(in, tone.text))
+            return false;
+    }
+    return true;
+}
+
+void writeKbm(juce::MemoryOutputStream &out, const scala::KbmData &kbm)
+{
+    out.writeInt(kbm.size);
+    out.writeInt(kbm.firstNote);
+    out.writeInt(kbm.lastNote);
+    out.writeInt(kbm.middleNote);
+    out.writeInt(kbm.referenceNote);
+    out.writeDouble(kbm.referenceFrequency);
+    out.writeInt(kbm.octaveDegree);
+    out.writeCompressedInt((int)kbm.keys.size());
+    for (auto key : kbm.keys)
+        out.writeInt(key);
+}
+
+bool readKbm(juce::MemoryInputStream &in, scala::KbmData &kbm)
+{
+    kbm.size = in.readInt();
+    kbm.firstNote = in.readInt();
+    kbm.lastNote = in.readInt();
+    kbm.middleNote = in.readInt();
+    kbm.referenceNote = in.readInt();
+    kbm.referenceFrequency = in.readDouble();
+    kbm.octaveDegree = in.readInt();
+    const int numKeys = in.readCompressedInt();
+    if (numKeys < 0 || numKeys > maxKeys)
+        return false;
+    kbm.keys.resize((size_t)numKeys);
+    for (auto &key : kbm.keys)
+        key = in.readInt();
+    return true;
+}
+} // namespace
+
+void StateChunk::writeTo(juce::MemoryBlock &dest) const
+{
+    juce::MemoryOutputStream out(dest, false);
+    out.writeInt(magic);
+    out.writeInt(currentVersion);
+
+    out.writeCompressedInt((int)paramValues.size());
+    for (auto &p : paramValues)
+    {
+        out.writeString(p.id);
+        out.writeFloat(p.value);
+    }
+
+    out.writeInt(renderThreads);
+    out.writeInt(polyphony);
+    out.writeFloat(cpuBudget);
+    out.writeFloat(voiceSleepLevel);
+    out.writeFloat(outputGain);
+    out.writeBool(outputLimiter);
+
+    out.writeString(customScaleName);
+    out.writeString(customScaleData);
+    out.writeString(customScaleText);
+    out.writeString(customKbmText);
+    out.writeBool(hasScl);
+    if (hasScl)
+        writeScl(out, scl);
+    out.writeBool(hasKbm);
+    if (hasKbm)
+        writeKbm(out, kbm);
+    out.writeInt(magic);
+}
+
+bool StateChunk::isStateChunk(const void *data, int sizeInBytes)
+{
+    if (data == nullptr || sizeInBytes < 8)
+        return false;
+    juce::MemoryInputStream in(data, (size_t)sizeInBytes, false);
+    return in.readInt() == magic;
+}
+
+bool StateChunk::readFrom(const void *data, int sizeInBytes)
+{
+    if (!isStateChunk(data, sizeInBytes))
+        return false;
+    juce::MemoryInputStream in(data, (size_t)sizeInBytes, false);
+    in.readInt();
+    const int version = in.readInt();
+    if (version != currentVersion)
+        return false;
+
+    const int numParams = in.readCompressedInt();
+    if (numParams < 0 || numParams > maxParams)
+        return false;
+    paramValues.resize((size_t)numParams);
+    for (auto &p : paramValues)
+    {
+        p.id = in.readString();
+        p.value = in.readFloat();
+    }
+
+    renderThreads = in.readInt();
+    polyphony = in.readInt();
+    cpuBudget = in.readFloat();
+    voiceSleepLevel = in.readFloat();
+    outputGain = in.readFloat();
+    outputLimiter = in.readBool();
+
+    customScaleName = in.readString();
+    customScaleData = in.readString();
+    customScaleText = in.readString();
+    customKbmText = in.readString();
+    hasScl = in.readBool();
+    if (hasScl && !readScl(in, scl))
+        return false;
+    hasKbm = in.readBool();
+    if (hasKbm && !readKbm(in, kbm))
+        return false;
+    // reading past the end gives zeros rather than failing, the closing magic number shows
+    // that everything before it was there
+    return in.readInt() == magic;
+}
+
+bool StateChunk::readFromLegacyXml(const void *data, int sizeInBytes,
+                                   const juce::Identifier &paramsType)
+{
+    auto xmlState = juce::AudioProcessor::getXmlFromBinary(data, sizeInBytes);
+    if (xmlState == nullptr)
+        return false;
+    if (auto *xmlParams = xmlState->getChildByName(paramsType))
+    {
+        for (auto *param : xmlParams->getChildWithTagNameIterator("PARAM"))
+            paramValues.push_back({param->getStringAttribute("id"),
+                                   (float)param->getDoubleAttribute("value")});
+    }
+    if (auto *xmlScale = xmlState->getChildByName("scaleParams"))
+    {
+        customScaleName = xmlScale->getStringAttribute("CUSTOM_SCALE_NAME", "custom");
+        customScaleData = xmlScale->getStringAttribute("CUSTOM_SCALE_DATA");
+        // sessions saved by older versions only have the line based scale data
+        customScaleText = xmlScale->getStringAttribute("CUSTOM_SCALE_DATA2", customScaleData);
+        customKbmText = xmlScale->getStringAttribute("CUSTOM_KBM_DATA");
+        const auto sclText = customScaleText.toStdString();
+        hasScl = sclText.size() > 0 && scala::parseScl(sclText, scl).empty();
+        const auto kbmText = customKbmText.toStdString();
+        hasKbm = kbmText.size() > 0 && scala::parseKbm(kbmText, kbm).empty();
+    }
+    return true;
+}
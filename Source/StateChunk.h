@@ -0,0 +1,61 @@
+/*
+  ==============================================================================
+
+    StateChunk.h
+
+    Xenos: Xenharmonic Stochastic Synthesizer
+    Raphael Radna
+    This code is licensed under the GPLv3
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+#include "ScalaParser.h"
+
+// The session state as a compact, versioned binary chunk. Besides the parameter values it
+// carries the custom scale and keyboard mapping already parsed, so restoring a session doesn't
+// run the Scala parser again. Sessions saved as XML by older versions are told apart by the
+// magic number and read into a chunk with readFromLegacyXml.
+struct StateChunk
+{
+    static constexpr int magic = 0x534e4558; // "XENS"
+    static constexpr int currentVersion = 1;
+
+    // Saved with their IDs, so that adding, removing or reordering parameters doesn't shift
+    // the values of a saved session
+    struct ParamValue
+    {
+        juce::String id;
+        float value = 0.0f;
+    };
+    std::vector<ParamValue> paramValues;
+
+    int renderThreads = 1;
+    int polyphony = 0;
+    float cpuBudget = 0.0f;
+    float voiceSleepLevel = -96.0f;
+    float outputGain = 0.0f;
+    bool outputLimiter = false;
+
+    juce::String customScaleName;
+    juce::String customScaleData;
+    juce::String customScaleText;
+    juce::String customKbmText;
+    // the parsed forms of the texts above, when they parsed
+    bool hasScl = false;
+    scala::SclData scl;
+    bool hasKbm = false;
+    scala::KbmData kbm;
+
+    void writeTo(juce::MemoryBlock &dest) const;
+    // false if the data isn't a binary chunk, or one from a newer version, or is truncated
+    bool readFrom(const void *data, int sizeInBytes);
+    // Sessions saved by older versions, as AudioProcessor::copyXmlToBinary XML with the
+    // parameter tree named paramsType and the custom scale. Parses the scale and mapping, the
+    // settings the XML doesn't have keep their defaults. False if the data isn't XML.
+    bool readFromLegacyXml(const void *data, int sizeInBytes, const juce::Identifier &paramsType);
+    static bool isStateChunk(const void *data, int sizeInBytes);
+};
@@ -0,0 +1,244 @@
+/*
+  ==============================================================================
+
+    TraceRecorder.h
+
+    Xenos: Xenharmonic Stochastic Synthesizer
+    Raphael Radna
+    This code is licensed under the GPLv3
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <juce_core/juce_core.h>
+#include <array>
+#include <atomic>
+#include <memory>
+#include "choc_SingleReaderSingleWriterFIFO.h"
+#include "RealtimeGuard.h"
+
+// Trace points for the audio hot paths, compiled in only when XENOS_TRACE is defined (the
+// XENOS_TRACE CMake option). Without it the macros expand to nothing.
+//
+// XENOS_TRACE_SCOPE(name) records how long the enclosing scope took and XENOS_TRACE_INSTANT
+// records a point in time. The name must be a string literal. Every thread writes fixed-size
+// events into a lock-free FIFO of its own, taken from a pool made up front, so recording
+// neither locks nor allocates. A thread gives its FIFO back when it exits, so threads that
+// come and go, like the render workers when their number changes, don't run out of them.
+// A background thread drains the FIFOs into a Chrome trace JSON
+// file in the temporary directory, which chrome://tracing and the Perfetto UI open. Events
+// are only recorded while a TraceRecorder exists, the processors keep one alive through a
+// juce::SharedResourcePointer, which outlives their audio and render threads.
+namespace trace
+{
+struct Event
+{
+    const char *name = nullptr;
+    juce::int64 start = 0;
+    // -1 for an instant event
+    juce::int64 end = -1;
+};
+
+class TraceRecorder : private juce::Thread
+{
+  public:
+    static constexpr int maxThreads = 32;
+    static constexpr int eventsPerThread = 8192;
+
+    TraceRecorder() : juce::Thread("Trace writer")
+    {
+        for (auto &b : buffers)
+            b.events.reset(eventsPerThread);
+        auto name = "xenos_trace_" + juce::Time::getCurrentTime().formatted("%Y%m%d_%H%M%S") +
+                    ".json";
+        file = juce::File::getSpecialLocation(juce::File::tempDirectory).getChildFile(name);
+        stream = file.createOutputStream();
+        if (stream)
+            *stream << "{\"traceEvents\":[\n";
+        ++generation();
+        instance().store(this);
+        startThread();
+    }
+    ~TraceRecorder() override
+    {
+        instance().store(nullptr);
+        stopThread(2000);
+        writeEvents();
+        if (stream)
+        {
+            *stream << "\n],\"droppedEvents\":" << (juce::int64)droppedEvents.load() << "}\n";
+            stream->flush();
+        }
+    }
+
+    juce::File getFile() const { return file; }
+
+    // Called by the trace points, records nothing when there's no recorder
+    static void record(const Event &ev)
+    {
+        auto *recorder = instance().load(std::memory_order_acquire);
+        if (recorder)
+            recorder->push(ev);
+    }
+
+  private:
+    struct ThreadBuffer
+    {
+        choc::fifo::SingleReaderSingleWriterFIFO<Event> events;
+    };
+    // a thread's slot, released when the thread exits
+    struct ThreadSlot
+    {
+        int slot = -1;
+        int generation = -1;
+        ~ThreadSlot()
+        {
+            if (slot >= 0)
+                releaseSlot(slot, generation);
+        }
+    };
+
+    static std::atomic<TraceRecorder *> &instance()
+    {
+        static std::atomic<TraceRecorder *> recorder{nullptr};
+        return recorder;
+    }
+    // a new recorder makes the threads pick new buffers, the first one is 1
+    static std::atomic<int> &generation()
+    {
+        static std::atomic<int> value{0};
+        return value;
+    }
+    // The generation each slot is held by, 0 when a thread gave it back. A slot held by an
+    // older generation is free as well, so a new recorder starts with all of them free. Static
+    // rather than in the recorder, because a thread may exit after its recorder is gone.
+    static std::array<std::atomic<int>, maxThreads> &slotOwners()
+    {
+        static std::array<std::atomic<int>, maxThreads> owners{};
+        return owners;
+    }
+    // -1 when all slots are taken
+    static int claimSlot(int currentGeneration)
+    {
+        auto &owners = slotOwners();
+        for (int i = 0; i < maxThreads; ++i)
+        {
+            int owner = owners[i].load(std::memory_order_relaxed);
+            while (owner != currentGeneration)
+                if (owners[i].compare_exchange_weak(owner, currentGeneration,
+                                                    std::memory_order_acquire))
+                    return i;
+        }
+        return -1;
+    }
+    // only if the slot still belongs to the thread's generation
+    static void releaseSlot(int slot, int slotGeneration)
+    {
+        slotOwners()[slot].compare_exchange_strong(slotGeneration, 0, std::memory_order_release);
+    }
+
+    void push(const Event &ev)
+    {
+        thread_local ThreadBuffer *buffer = nullptr;
+        thread_local int bufferGeneration = -1;
+        const int currentGeneration = generation().load(std::memory_order_relaxed);
+        if (bufferGeneration != currentGeneration)
+        {
+            // the first use registers the slot's destructor for the thread's exit, which may
+            // allocate once per thread
+            rt_guard::ScopedAllowViolations registeringThreadExit;
+            thread_local ThreadSlot threadSlot;
+            if (threadSlot.slot >= 0)
+                releaseSlot(threadSlot.slot, threadSlot.generation);
+            threadSlot.slot = claimSlot(currentGeneration);
+            threadSlot.generation = currentGeneration;
+            buffer = threadSlot.slot >= 0 ? &buffers[threadSlot.slot] : nullptr;
+            bufferGeneration = currentGeneration;
+        }
+        if (!buffer || !buffer->events.push(ev))
+            droppedEvents.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void run() override
+    {
+        while (!threadShouldExit())
+        {
+            wait(50);
+            writeEvents();
+        }
+    }
+
+    void writeEvents()
+    {
+        if (!stream)
+            return;
+        for (int tid = 0; tid < maxThreads; ++tid)
+        {
+            Event ev;
+            while (buffers[tid].events.pop(ev))
+                writeEvent(ev, tid);
+        }
+    }
+
+    void writeEvent(const Event &ev, int tid)
+    {
+        auto &out = *stream;
+        if (numWritten++ > 0)
+            out << ",\n";
+        out << "{\"name\":\"" << ev.name << "\",\"pid\":1,\"tid\":" << tid
+            << ",\"ts\":" << juce::String(toMicroseconds(ev.start), 3);
+        if (ev.end < 0)
+            out << ",\"ph\":\"i\",\"s\":\"t\"}";
+        else
+            out << ",\"ph\":\"X\",\"dur\":" << juce::String(toMicroseconds(ev.end - ev.start), 3)
+                << "}";
+    }
+
+    static double toMicroseconds(juce::int64 ticks)
+    {
+        return juce::Time::highResolutionTicksToSeconds(ticks) * 1.0e6;
+    }
+
+    std::array<ThreadBuffer, maxThreads> buffers;
+    std::atomic<juce::uint64> droppedEvents{0};
+    juce::File file;
+    std::unique_ptr<juce::FileOutputStream> stream;
+    juce::int64 numWritten = 0;
+};
+
+class ScopedTrace
+{
+  public:
+    explicit ScopedTrace(const char *name)
+    {
+        ev.name = name;
+        ev.start = juce::Time::getHighResolutionTicks();
+    }
+    ~ScopedTrace()
+    {
+        ev.end = juce::Time::getHighResolutionTicks();
+        TraceRecorder::record(ev);
+    }
+
+  private:
+    Event ev;
+};
+
+inline void instant(const char *name)
+{
+    Event ev;
+    ev.name = name;
+    ev.start = juce::Time::getHighResolutionTicks();
+    TraceRecorder::record(ev);
+}
+} // namespace trace
+
+#if XENOS_TRACE
+#define XENOS_TRACE_SCOPE(name) trace::ScopedTrace JUCE_JOIN_MACRO(xenosTrace, __LINE__)(name)
+#define XENOS_TRACE_INSTANT(name) trace::instant(name)
+#else
+#define XENOS_TRACE_SCOPE(name)
+#define XENOS_TRACE_INSTANT(name)
+#endif
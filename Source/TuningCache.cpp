@@ -0,0 +1,127 @@
+/*
+  ==============================================================================
+
+    TuningCache.cpp
+
+    Xenos: Xenharmonic Stochastic Synthesizer
+    Raphael Radna
+    This code is licensed under the GPLv3
+
+  ==============================================================================
+*/
+
+#include <cstring>
+#include "TuningCache.h"
+
+namespace
+{
+// FNV-1a, the hashes only need to tell tunings apart within one process
+struct Hasher
+{
+    uint64_t value = 14695981039346656037ULL;
+    void add(const void *data, size_t size)
+    {
+        auto bytes = static_cast<const unsigned char *>(data);
+        for (size_t i = 0; i < size; ++i)
+        {
+            value ^= bytes[i];
+            value *= 1099511628211ULL;
+        }
+    }
+    void add(int x) { add(&x, sizeof(x)); }
+    void add(double x)
+    {
+        // -0.0 and 0.0 give the same tuning
+        if (x == 0.0)
+            x = 0.0;
+        add(&x, sizeof(x));
+    }
+};
+} // namespace
+
+TuningCache::TuningCache()
+    : defaultTuning(std::make_shared<const Tunings::Tuning>())
+{
+    tunings[{hashScale(defaultTuning->scale), hashKeyboardMapping(defaultTuning->keyboardMapping)}] =
+        defaultTuning;
+}
+
+TuningCache::TuningPtr TuningCache::get(const Tunings::Scale &scale,
+                                        const Tunings::KeyboardMapping &kbm)
+{
+    Key key{hashScale(scale), hashKeyboardMapping(kbm)};
+    std::lock_guard<std::mutex> guard(mutex);
+    auto it = tunings.find(key);
+    if (it != tunings.end())
+    {
+        if (auto existing = it->second.lock())
+            return existing;
+    }
+    removeExpired();
+    auto result = std::make_shared<const Tunings::Tuning>(scale, kbm);
+    tunings[key] = result;
+    return result;
+}
+
+int TuningCache::getNumTunings()
+{
+    std::lock_guard<std::mutex> guard(mutex);
+    removeExpired();
+    return (int)tunings.size();
+}
+
+size_t TuningCache::getMemoryUsage()
+{
+    std::lock_guard<std::mutex> guard(mutex);
+    removeExpired();
+    size_t result = sizeof(*this);
+    for (auto &entry : tunings)
+    {
+        result += sizeof(entry) + 3 * sizeof(void *); // the map node
+        if (auto t = entry.second.lock())
+        {
+            result += sizeof(Tunings::Tuning);
+            result += t->scale.tones.capacity() * sizeof(Tunings::Tone);
+            result += t->scale.rawText.capacity() + t->keyboardMapping.rawText.capacity();
+            result += t->keyboardMapping.keys.capacity() * sizeof(int);
+        }
+    }
+    return result;
+}
+
+void TuningCache::removeExpired()
+{
+    for (auto it = tunings.begin(); it != tunings.end();)
+    {
+        if (it->second.expired())
+            it = tunings.erase(it);
+        else
+            ++it;
+    }
+}
+
+uint64_t TuningCache::hashScale(const Tunings::Scale &scale)
+{
+    // only the pitches matter for the compiled table, not the description or how the tones
+    // were written
+    Hasher h;
+    h.add(scale.count);
+    for (auto &tone : scale.tones)
+        h.add(tone.cents);
+    return h.value;
+}
+
+uint64_t TuningCache::hashKeyboardMapping(const Tunings::KeyboardMapping &kbm)
+{
+    Hasher h;
+    h.add(kbm.count);
+    h.add(kbm.firstMidi);
+    h.add(kbm.lastMidi);
+    h.add(kbm.middleNote);
+    h.add(kbm.tuningConstantNote);
+    h.add(kbm.tuningFrequency);
+    h.add(kbm.octaveDegrees);
+    for (auto key : kbm.keys)
+        h.add(key);
+    return h.value;
+}
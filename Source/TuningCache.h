@@ -0,0 +1,54 @@
+/*
+  ==============================================================================
+
+    TuningCache.h
+
+    Xenos: Xenharmonic Stochastic Synthesizer
+    Raphael Radna
+    This code is licensed under the GPLv3
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <juce_core/juce_core.h>
+#include <map>
+#include <memory>
+#include <mutex>
+#include "Tunings.h"
+
+// Compiled tuning tables shared by every engine in the process, through
+// juce::SharedResourcePointer<TuningCache>. A Tunings::Tuning holds several kilobytes of
+// frequency tables, so instances using the same scale and keyboard mapping share one table.
+// The cache only keeps weak references, a table is freed when the last engine using it lets go.
+// Note that each plugin binary gets its own cache, the statics aren't shared between modules.
+class TuningCache
+{
+  public:
+    using TuningPtr = std::shared_ptr<const Tunings::Tuning>;
+
+    TuningCache();
+
+    // Returns the table for the scale and mapping, compiling it only if nothing in the process
+    // holds it at the moment. Throws Tunings::TuningError like the Tunings::Tuning constructor.
+    TuningPtr get(const Tunings::Scale &scale, const Tunings::KeyboardMapping &kbm);
+    // 12-EDO with the standard mapping, the same as a default constructed Tunings::Tuning
+    TuningPtr getDefault() const { return defaultTuning; }
+
+    int getNumTunings();
+    size_t getMemoryUsage();
+
+    static uint64_t hashScale(const Tunings::Scale &scale);
+    static uint64_t hashKeyboardMapping(const Tunings::KeyboardMapping &kbm);
+
+  private:
+    using Key = std::pair<uint64_t, uint64_t>;
+    void removeExpired();
+
+    std::map<Key, std::weak_ptr<const Tunings::Tuning>> tunings;
+    TuningPtr defaultTuning;
+    std::mutex mutex;
+
+    JUCE_DECLARE_NON_COPYABLE(TuningCache)
+};
@@ -0,0 +1,90 @@
+/*
+  ==============================================================================
+
+    VoiceGovernor.h
+
+    Xenos: Xenharmonic Stochastic Synthesizer
+    Raphael Radna
+    This code is licensed under the GPLv3
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <juce_core/juce_core.h>
+#include <atomic>
+#include <limits>
+
+// Keeps the number of sounding voices within a CPU budget. It's fed the measured load once per
+// block, as a proportion of the block's duration, and answers with a voice ceiling. When the
+// load goes over the budget the ceiling drops below the number of voices playing, scaled by how
+// far over the budget the load is, and the synth fades out the voices above it. Under the
+// budget the ceiling creeps back up to the polyphony limit.
+//
+// The measured load is smoothed, so it lags behind the voice count. After shedding, the
+// governor waits for the load to catch up before shedding again.
+class VoiceGovernor
+{
+  public:
+    // the proportion of the block duration the synth may use, 0 turns the governor off
+    void setBudget(float newBudget) { budget.store(juce::jlimit(0.0f, 1.0f, newBudget)); }
+    float getBudget() const { return budget.load(); }
+
+    // blocksPerSecond sets how long the governor waits after shedding voices
+    void prepare(double blocksPerSecond)
+    {
+        holdBlocks = juce::jmax(1, juce::roundToInt(blocksPerSecond * holdSeconds));
+        holdCounter = 0;
+    }
+
+    // Returns how many voices may sound in the next block, between minVoices and limit
+    int update(float load, int numSounding, int limit)
+    {
+        const float b = budget.load(std::memory_order_relaxed);
+        int c = ceiling.load(std::memory_order_relaxed);
+        if (b <= 0.0f)
+        {
+            c = limit;
+        }
+        else
+        {
+            c = juce::jmin(c, limit);
+            if (holdCounter > 0)
+                --holdCounter;
+            if (load > b && holdCounter == 0)
+            {
+                const int target = (int)(numSounding * b / load);
+                if (target < c)
+                {
+                    c = target;
+                    numSheds.fetch_add(1, std::memory_order_relaxed);
+                }
+                holdCounter = holdBlocks;
+            }
+            else if (load < b * recoverRatio && holdCounter == 0)
+            {
+                c += juce::jmax(1, c / 16);
+            }
+            c = juce::jlimit(juce::jmin(minVoices, limit), limit, c);
+        }
+        ceiling.store(c, std::memory_order_relaxed);
+        return c;
+    }
+
+    // these two may be read from any thread, for display
+    int getCeiling() const { return ceiling.load(std::memory_order_relaxed); }
+    int getNumSheds() const { return numSheds.load(std::memory_order_relaxed); }
+
+    static constexpr int minVoices = 4;
+
+  private:
+    static constexpr float holdSeconds = 0.25f;
+    static constexpr float recoverRatio = 0.8f;
+
+    std::atomic<float> budget{0.0f};
+    std::atomic<int> ceiling{std::numeric_limits<int>::max()};
+    std::atomic<int> numSheds{0};
+    int holdBlocks = 1;
+    int holdCounter = 0;
+};
@@ -0,0 +1,154 @@
+/*
+  ==============================================================================
+
+    VoiceRenderPool.cpp
+
+    Xenos: Xenharmonic Stochastic Synthesizer
+    Raphael Radna
+    This code is licensed under the GPLv3
+
+  ==============================================================================
+*/
+
+#include "VoiceRenderPool.h"
+#include "RealtimeGuard.h"
+#include <climits>
+#if JUCE_LINUX
+#include <linux/futex.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#elif JUCE_WINDOWS
+#include <windows.h>
+#pragma comment(lib, "Synchronization.lib")
+#endif
+
+VoiceRenderPool::VoiceRenderPool(int numThreads_, int maxBlockSize_)
+    : numThreads(juce::jlimit(1, (1 << threadBits) - 1, numThreads_)),
+      maxBlockSize(juce::jmax(1, maxBlockSize_)), threadBuffers(numThreads * 2, maxBlockSize)
+{
+    workers.reserve(numThreads - 1);
+    for (int i = 1; i < numThreads; ++i)
+        workers.emplace_back([this, i]() { workerLoop(i); });
+}
+
+VoiceRenderPool::~VoiceRenderPool()
+{
+    shouldExit = true;
+    // a new word with no participants, a worker that goes to sleep after this wakes up by its
+    // timeout
+    published.store(((published.load() >> threadBits) + 1) << threadBits);
+    wakeWorkers();
+    for (auto &w : workers)
+        w.join();
+}
+
+void VoiceRenderPool::render(Job &job, int numVoices, int threadsToUse, float *left,
+                             float *right, int numSamples)
+{
+    jassert(numSamples <= maxBlockSize);
+    threadsToUse = juce::jlimit(1, numThreads, threadsToUse);
+    // the workers of the previous job are all done, none of them reads this any more
+    currentJob = {&job, numVoices, threadsToUse, numSamples};
+    if (threadsToUse > 1)
+    {
+        sharesRemaining.store(threadsToUse - 1, std::memory_order_relaxed);
+        const uint32_t generation = (published.load(std::memory_order_relaxed) >> threadBits) + 1;
+        published.store((generation << threadBits) | (uint32_t)threadsToUse);
+        if (numSleeping.load() > 0)
+            wakeWorkers();
+    }
+    renderShare(currentJob, 0);
+    while (sharesRemaining.load(std::memory_order_acquire) > 0)
+        std::this_thread::yield();
+    for (int i = 0; i < threadsToUse; ++i)
+    {
+        juce::FloatVectorOperations::add(left, threadBuffers.getReadPointer(i * 2), numSamples);
+        if (right)
+            juce::FloatVectorOperations::add(right, threadBuffers.getReadPointer(i * 2 + 1),
+                                             numSamples);
+    }
+}
+
+void VoiceRenderPool::renderShare(const JobSnapshot &snapshot, int threadIndex)
+{
+    const int share = (snapshot.numVoices + snapshot.threadsToUse - 1) / snapshot.threadsToUse;
+    const int first = juce::jmin(snapshot.numVoices, threadIndex * share);
+    const int last = juce::jmin(snapshot.numVoices, first + share);
+    float *left = threadBuffers.getWritePointer(threadIndex * 2);
+    float *right = threadBuffers.getWritePointer(threadIndex * 2 + 1);
+    juce::FloatVectorOperations::clear(left, snapshot.numSamples);
+    juce::FloatVectorOperations::clear(right, snapshot.numSamples);
+    if (first < last)
+        snapshot.job->renderVoices(first, last, left, right, snapshot.numSamples);
+}
+
+static_assert(sizeof(std::atomic<uint32_t>) == sizeof(uint32_t), "the word is waited on in place");
+
+// Sleeps while the word is unchanged, for at most 100 ms
+void VoiceRenderPool::waitForJob(uint32_t seenWord)
+{
+    // paired with the load of numSleeping after the store of a new word, one of the two threads
+    // sees the other's write
+    numSleeping.fetch_add(1);
+    if (published.load() == seenWord)
+    {
+#if JUCE_LINUX
+        timespec timeout{0, 100 * 1000 * 1000};
+        syscall(SYS_futex, reinterpret_cast<uint32_t *>(&published), FUTEX_WAIT_PRIVATE, seenWord,
+                &timeout, nullptr, 0);
+#elif JUCE_WINDOWS
+        WaitOnAddress(&published, &seenWord, sizeof(seenWord), 100);
+#else
+        for (int i = 0; i < 100 && published.load() == seenWord && !shouldExit; ++i)
+            juce::Thread::sleep(1);
+#endif
+    }
+    numSleeping.fetch_sub(1);
+}
+
+void VoiceRenderPool::wakeWorkers()
+{
+#if JUCE_LINUX
+    syscall(SYS_futex, reinterpret_cast<uint32_t *>(&published), FUTEX_WAKE_PRIVATE, INT_MAX,
+            nullptr, nullptr, 0);
+#elif JUCE_WINDOWS
+    WakeByAddressAll(&published);
+#endif
+}
+
+void VoiceRenderPool::workerLoop(int threadIndex)
+{
+    // the host only sets this up for its own audio thread, the voices need it here as well
+    juce::ScopedNoDenormals noDenormals;
+#if JUCE_LINUX
+    sched_param param;
+    param.sched_priority = sched_get_priority_min(SCHED_FIFO) + 1;
+    pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+#endif
+
+    uint32_t seenWord = published.load(std::memory_order_acquire);
+    while (!shouldExit)
+    {
+        uint32_t word = published.load(std::memory_order_acquire);
+        for (int spins = 0; word == seenWord && spins < 2000 && !shouldExit; ++spins)
+        {
+            std::this_thread::yield();
+            word = published.load(std::memory_order_acquire);
+        }
+        if (word == seenWord)
+        {
+            waitForJob(seenWord);
+            continue;
+        }
+        seenWord = word;
+        // whether this thread takes part follows from the word alone, only then is the job read
+        if (threadIndex < getThreadsToUse(word) && !shouldExit)
+        {
+            rt_guard::ScopedRealtimeContext realtimeContext;
+            renderShare(currentJob, threadIndex);
+            sharesRemaining.fetch_sub(1, std::memory_order_acq_rel);
+        }
+    }
+}
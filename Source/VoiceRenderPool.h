@@ -0,0 +1,90 @@
+/*
+  ==============================================================================
+
+    VoiceRenderPool.h
+
+    Xenos: Xenharmonic Stochastic Synthesizer
+    Raphael Radna
+    This code is licensed under the GPLv3
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+#include <atomic>
+#include <thread>
+
+// Worker threads for rendering the voices of a block in parallel. The calling audio thread takes
+// the first share of the voices and the workers the rest. Every thread renders into its own
+// stereo buffer, and the buffers are added to the output in thread order once all are done, so
+// the result only depends on the number of threads and not on the scheduling.
+//
+// A job is published as one 32-bit word holding a generation count and the number of threads
+// taking part, so a worker knows from the word it observed alone whether it has a share. The
+// job's details are only read by the participants, which the audio thread waits for before it
+// publishes the next job.
+//
+// The workers spin for a short while after finishing a share, because the next block usually
+// follows soon, and sleep on the word after that. Waking them takes no lock: on Linux it's a
+// futex and on Windows WaitOnAddress, elsewhere sleeping workers poll the word every
+// millisecond. On Linux they ask for SCHED_FIFO priority, which quietly fails without the rights
+// for it. They aren't pinned to CPUs, with several instances running the scheduler spreads their
+// workers better than a fixed mapping would. Denormals are flushed to zero on the workers as on
+// the host's audio thread.
+class VoiceRenderPool
+{
+  public:
+    struct Job
+    {
+        virtual ~Job() = default;
+        // Renders voices [first, last) into the start of the given buffers, which are cleared
+        virtual void renderVoices(int first, int last, float *left, float *right,
+                                  int numSamples) = 0;
+    };
+
+    // numThreads includes the audio thread, so numThreads - 1 workers are started
+    VoiceRenderPool(int numThreads, int maxBlockSize);
+    ~VoiceRenderPool();
+
+    int getNumThreads() const { return numThreads; }
+    int getMaxBlockSize() const { return maxBlockSize; }
+
+    // Adds numVoices voices rendered by threadsToUse threads into left and right. right may be
+    // null for mono output. numSamples must not exceed the maximum block size.
+    void render(Job &job, int numVoices, int threadsToUse, float *left, float *right,
+                int numSamples);
+
+  private:
+    struct JobSnapshot
+    {
+        Job *job = nullptr;
+        int numVoices = 0;
+        int threadsToUse = 0;
+        int numSamples = 0;
+    };
+    // the published word: the generation in the upper bits, the threads taking part below
+    static constexpr int threadBits = 8;
+    static int getThreadsToUse(uint32_t word) { return (int)(word & ((1u << threadBits) - 1)); }
+
+    void workerLoop(int threadIndex);
+    void renderShare(const JobSnapshot &snapshot, int threadIndex);
+    void waitForJob(uint32_t seenWord);
+    void wakeWorkers();
+
+    const int numThreads;
+    const int maxBlockSize;
+    juce::AudioBuffer<float> threadBuffers; // two channels per thread
+    std::vector<std::thread> workers;
+
+    // Written by the audio thread before the release of the next word. Only the participants
+    // read it, and the audio thread doesn't write it again until they're all done.
+    JobSnapshot currentJob;
+    std::atomic<uint32_t> published{0};
+    std::atomic<int> sharesRemaining{0};
+    std::atomic<int> numSleeping{0};
+    std::atomic<bool> shouldExit{false};
+
+    JUCE_DECLARE_NON_COPYABLE(VoiceRenderPool)
+};
@@ -0,0 +1,70 @@
+/*
+  ==============================================================================
+
+    VoiceTelemetry.h
+
+    Xenos: Xenharmonic Stochastic Synthesizer
+    Raphael Radna
+    This code is licensed under the GPLv3
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+
+// What the GUI shows of the sounding voices, published by the audio thread once per block.
+//
+// A triple buffer: the audio thread fills one snapshot while the GUI reads another, and the
+// third is the latest complete one, swapped in and out with a single atomic exchange. Neither
+// side waits for the other or sees a snapshot that's being written. The snapshots and each
+// side's index are on cache lines of their own, the only line both threads touch is the one
+// with the index they exchange.
+template <int maxVoices> class VoiceTelemetry
+{
+  public:
+    struct Voice
+    {
+        float hz = 0.0f;
+        float pan = 0.5f;
+        float level = 0.0f;
+    };
+
+    // only the first numVoices entries are valid
+    struct Snapshot
+    {
+        int numVoices = 0;
+        std::array<Voice, maxVoices> voices;
+    };
+
+    // Audio thread: fill in the snapshot from beginWrite(), then publish it with endWrite()
+    Snapshot &beginWrite() { return buffers[writeIndex].snapshot; }
+    void endWrite()
+    {
+        writeIndex = latest.exchange(writeIndex | freshBit, std::memory_order_acq_rel) & indexMask;
+    }
+
+    // GUI thread: the latest published snapshot, which stays valid until the next read()
+    const Snapshot &read()
+    {
+        if (latest.load(std::memory_order_relaxed) & freshBit)
+            readIndex = latest.exchange(readIndex, std::memory_order_acq_rel) & indexMask;
+        return buffers[readIndex].snapshot;
+    }
+
+  private:
+    static constexpr uint32_t indexMask = 3;
+    static constexpr uint32_t freshBit = 4;
+
+    struct alignas(64) Buffer
+    {
+        Snapshot snapshot;
+    };
+    Buffer buffers[3];
+    alignas(64) std::atomic<uint32_t> latest{1};
+    alignas(64) uint32_t writeIndex = 0;
+    alignas(64) uint32_t readIndex = 2;
+};
@@ -12,6 +12,7 @@
 
 #pragma once
 
+#include <bitset>
 #include <iostream>
 #include <random>
 #include "Quantizer.h"
@@ -22,23 +23,54 @@
 #include "sst/basic-blocks/modulators/SimpleLFO.h"
 #include "SSTQuantizer.h"
 #include "somedsp.h"
+#include "SRProvider.h"
+#include "choc_SingleReaderSingleWriterFIFO.h"
+#include "VoiceRenderPool.h"
+#include "VoiceGovernor.h"
+#include "BlockADSR.h"
+#include "EqualPowerPan.h"
+#include "EngineEvents.h"
+#include "XenosParams.h"
+#include "VoiceTelemetry.h"
+#include "BreakpointScope.h"
+#include "CycleAccounting.h"
+#include "TraceRecorder.h"
+#include "AudioHandover.h"
 
 #define MAX_POINTS (128)
+// the default polyphony, also the reference for the level of a single voice
 #define NUM_VOICES (128)
+// the voice pool can grow up to this many voices at runtime
+#define MAX_VOICES (1024)
+
+static_assert(BreakpointSnapshot::maxPoints >= MAX_POINTS, "a snapshot must hold every point");
+
+// The walk and distribution settings, the same for all voices of an engine. The voices refer
+// to one instance, so a parameter change is made once instead of once per voice.
+struct XenosWalkParams
+{
+    RandomWalkParams pitchWalk, ampWalk;
+    RandomSourceParams pitchSource, ampSource;
+};
 
 struct XenosCore
 {
+    // the pitch walk's barriers follow the note, so only its ratios are shared
+    void setWalkParams(const XenosWalkParams *wp)
+    {
+        pitchWalk.setShared(&wp->pitchWalk, false);
+        ampWalk.setShared(&wp->ampWalk, true);
+        pitchSource.setParams(&wp->pitchSource);
+        ampSource.setParams(&wp->ampSource);
+    }
     void initialize(double sr)
     {
         sampleRate = sr;
         pitchWalk.initialize(MAX_POINTS);
         ampWalk.initialize(MAX_POINTS);
-        ampWalk.setParams(1.0);
         reset();
         hzSmoothingFilter.setParameters(BiquadFilter::LOWPASS_1POLE, 16.0 / sr, 1.0, 1.0);
     }
-    int tuningUpdateRate = 256;
-    int tuningUpdateCounter = 0;
     void reset()
     {
         for (unsigned i = 0; i < MAX_POINTS; ++i)
@@ -56,7 +88,7 @@ struct XenosCore
     {
         calcPeriodRange(pitchCenter, pitchWidthKeys);
         pitchWalk.setParams(periodRange, nPoints);
-        quantizer.calcSteps();
+        // the quantizer steps are rebuilt at the next cycle wrap if the range changed
     }
 
     void calcPeriodRange(double pC, double pW)
@@ -72,15 +104,6 @@ struct XenosCore
     BiquadFilter hzSmoothingFilter;
     double operator()()
     {
-        if (tuningUpdateCounter == 0)
-        {
-            if (quan2->use_oddsound && quan2->mts_client && MTS_HasMaster(quan2->mts_client))
-                setPitchCenter(pitchCenterAsKey);
-        }
-        ++tuningUpdateCounter;
-        if (tuningUpdateCounter == tuningUpdateRate)
-            tuningUpdateCounter = 0;
-
         if (index < 0.0)
             index = 0.0;
         int intdex = floor(index);
@@ -101,17 +124,32 @@ struct XenosCore
 
         if (index >= nPoints)
         {
+            XENOS_TRACE_INSTANT("XenosCore cycle wrap");
             // quantizer.setFactor(pitchWalk.getSumPeriod());
 
             index -= nPoints;
             if (nPoints_ > 0)
                 setNPoints();
+            quantizer.update();
             curHz = sampleRate / pitchWalk.getSumPeriod();
             curQuantizedHz = quan2->quantizeHz(curHz);
+            cycleWrapped = true;
         }
         return ampWalk(index, nPoints);
     }
 
+    // set at every cycle wrap, cleared when the breakpoints are read for the scope
+    bool cycleWrapped = false;
+    void getBreakpoints(BreakpointSnapshot &snapshot) const
+    {
+        snapshot.numPoints = nPoints;
+        for (int i = 0; i < nPoints; ++i)
+        {
+            snapshot.durations[i] = (float)pitchWalk.getPoint(i);
+            snapshot.amplitudes[i] = (float)ampWalk.getPoint(i);
+        }
+    }
+
     void step(int n)
     {
         pitchWalk.step(n, pitchSource());
@@ -125,23 +163,36 @@ struct XenosCore
         nPoints_ = 0;
     }
     double pitchCenterAsKey = 0.0;
+    int tuningNote = 0;
+    unsigned int tuningNoteVersion = 0;
 
     void setPitchCenter(float pC)
     {
         pitchCenterAsKey = pC;
-        if (quan2->use_oddsound && quan2->mts_client && MTS_HasMaster(quan2->mts_client))
+        tuningNote = juce::jlimit(0, 127, (int)pC);
+        tuningNoteVersion = quan2->getNoteVersion(tuningNote);
+        if (quan2->isExternalTuningActive())
         {
-            double diff = MTS_RetuningInSemitones(quan2->mts_client, pC, -1);
+            double diff = quan2->getExternalRetuningInSemitones(tuningNote);
             pitchCenter = pC + diff;
+            curHz = quan2->getExternalHz(tuningNote);
         }
         else
         {
-            pitchCenter = quan2->tuning.logScaledFrequencyForMidiNote(pC) * 12.0;
+            pitchCenter = quan2->getTuning().logScaledFrequencyForMidiNote(pC) * 12.0;
+            curHz = quan2->getTuning().frequencyForMidiNote(tuningNote);
         }
-        curHz = quan2->getHzForMidiNote(pC);
         calcMetaParams();
     }
 
+    // Called once per block after Quantizer2::updateExternalTuning(), only does the work when
+    // the note this voice plays was retuned
+    void updateTuning()
+    {
+        if (quan2->getNoteVersion(tuningNote) != tuningNoteVersion)
+            setPitchCenter(pitchCenterAsKey);
+    }
+
     void setPitchWidth(float pW)
     {
         pitchWidthKeys = pW;
@@ -175,6 +226,12 @@ struct XenosCore
     Quantizer2 *quan2 = nullptr;
     std::default_random_engine generator;
     std::uniform_real_distribution<double> uniform{-1.0, 1.0};
+
+    // heap memory owned by the core, sizeof(XenosCore) not included
+    size_t getMemoryUsage() const
+    {
+        return pitchWalk.getMemoryUsage() + ampWalk.getMemoryUsage() + quantizer.getMemoryUsage();
+    }
 };
 
 enum class VoicePanMode
@@ -194,182 +251,293 @@ enum class VoicePanMode
     Last
 };
 
-struct SRProvider
-{
-    static constexpr int BLOCK_SIZE = 32;
-    static constexpr int BLOCK_SIZE_OS = BLOCK_SIZE * 2;
-    SRProvider() { initTables(); }
-    alignas(32) float table_envrate_linear[512];
-    double samplerate = 44100.0;
-    void initTables()
-    {
-        double dsamplerate_os = samplerate * 2;
-        for (int i = 0; i < 512; ++i)
-        {
-            double k =
-                dsamplerate_os * pow(2.0, (((double)i - 256.0) / 16.0)) / (double)BLOCK_SIZE_OS;
-            table_envrate_linear[i] = (float)(1.f / k);
-        }
-    }
-    float envelope_rate_linear_nowrap(float x)
-    {
-        x *= 16.f;
-        x += 256.f;
-        int e = std::clamp<int>((int)x, 0, 0x1ff - 1);
-
-        float a = x - (float)e;
-
-        return (1 - a) * table_envrate_linear[e & 0x1ff] +
-               a * table_envrate_linear[(e + 1) & 0x1ff];
-    }
-};
-
-//==============================================================================
-struct XenosSound : public juce::SynthesiserSound
-{
-    XenosSound() { rng = std::minstd_rand((unsigned int)this); }
-
-    bool appliesToNote(int) override { return true; }
-    bool appliesToChannel(int) override { return true; }
-
-    std::minstd_rand rng;
-    std::uniform_real_distribution<float> panDistribution{0.0f, 1.0f};
-    // returns value in range 0.0 to 1.0, 0.5 center
-    float getPanPositionFromMidiKey(int key, VoicePanMode vpm, int *notecounter)
-    {
-        const float positions[3] = {0.0f, 0.5f, 1.0f};
-        if (vpm == VoicePanMode::AltLeftRight)
-            return (float)(key % 2);
-        else if (vpm == VoicePanMode::AltLeftCenterRight)
-            return positions[key % 3];
-        else if (vpm == VoicePanMode::Random)
-            return panDistribution(rng);
-        else if (vpm == VoicePanMode::Sine1Cycle)
-            return 0.5 + 0.5 * std::sin(2 * juce::MathConstants<float>::pi / 128 * key * 5.0f);
-        else if (vpm == VoicePanMode::Sine2Cycles)
-            return 0.5 + 0.5 * std::sin(2 * juce::MathConstants<float>::pi / 128 * key * 10.0f);
-        else if (vpm == VoicePanMode::AltLeftRight2 && notecounter != nullptr)
-            return (*notecounter) % 2;
-        else if (vpm == VoicePanMode::AltLeftCenterRight2 && notecounter != nullptr)
-            return positions[(*notecounter) % 3];
-        return 0.5f;
-    }
-};
-
 //==============================================================================
-struct XenosVoice : public juce::SynthesiserVoice
+struct XenosVoice
 {
     SRProvider *srprovider = nullptr;
-    XenosVoice(int *notecounter_, SRProvider *sp, Quantizer2 *qnt)
+    XenosVoice(int *notecounter_, SRProvider *sp, Quantizer2 *qnt, const QuantizerSettings *qs,
+               const XenosWalkParams *wp)
         : srprovider(sp), noteCounter(notecounter_)
     {
+        xenos.setWalkParams(wp);
         xenos.quan2 = qnt;
+        xenos.quantizer.setSettings(qs);
         lfo1 = std::make_unique<LFOType>(sp);
+        panRng.seed((unsigned int)(size_t)this);
     }
 
-    bool canPlaySound(juce::SynthesiserSound *sound) override
+    size_t getMemoryUsage() const
     {
-        return dynamic_cast<XenosSound *>(sound) != nullptr;
+        return sizeof(*this) + sizeof(LFOType) + xenos.getMemoryUsage();
     }
 
-    void setCurrentPlaybackSampleRate(double newRate) override
+    // the shared SRProvider is set up by the owner of the voices
+    void setCurrentPlaybackSampleRate(double newRate)
     {
         if (newRate > 0.0)
         {
             xenos.initialize(newRate);
             adsr.setSampleRate(newRate);
             updateADSR();
-            srprovider->samplerate = newRate;
-            srprovider->initTables();
+            sleepHoldSamples = juce::roundToInt(newRate * sleepHoldSeconds);
         }
     }
 
-    void updateADSR() { adsr.setParameters(juce::ADSR::Parameters(a, d, s, r)); }
+    void updateADSR() { adsr.setParameters(BlockADSR::Parameters(a, d, s, r)); }
 
-    void startNote(int note, float velocity, juce::SynthesiserSound *snd,
-                   int currentPitchWheelPosition) override
+    void startNote(int note, int channel, float velocity, int currentPitchWheelPosition)
     {
+        currentNote = note;
+        currentChannel = channel;
+        keyIsDown = true;
+        sustainPedalDown = false;
         xenos.setPitchCenter(note);
         xenos.setBend(currentPitchWheelPosition);
         adsr.noteOn();
         xenos.reset();
-        lfo_updatecounter = 0;
+        controlBlocks.reset();
+        fadeSamplesLeft = 0;
+        wakeUp();
     }
 
-    void stopNote(float /*velocity*/, bool allowTailOff) override
+    void stopNote(float /*velocity*/, bool allowTailOff)
     {
         if (adsr.isActive())
         {
-            adsr.noteOff();
+            // The release of a parked voice can only get quieter, so it ends right away. The
+            // voice is freed at the end of the next block, which a parked voice isn't rendered
+            // in, so the note is cleared here.
+            if (parked)
+            {
+                adsr.reset();
+                clearCurrentNote();
+            }
+            else
+                adsr.noteOff();
             // clearCurrentNote();
         }
     }
 
-    void pitchWheelMoved(int newPitchWheelValue) override { xenos.setBend(newPitchWheelValue); }
+    // A voice whose output stays below sleepThreshold for sleepHoldSamples goes to sleep. In
+    // its release it's ended, on the sustain plateau it's parked and not rendered until
+    // something that changes its level wakes it up. Attacks and decays are always rendered.
+    // A threshold of 0 turns this off.
+    void setSleepThreshold(float gain) { sleepThreshold = gain; }
+    bool isParked() const { return parked; }
+    void wakeUp()
+    {
+        parked = false;
+        silentSamples = 0;
+    }
 
-    void controllerMoved(int, int) override {}
+    // Fades the voice out over numSamples, after which it's free again. Used when the synth
+    // sheds voices, where cutting them off would click.
+    void startFadeOut(int numSamples)
+    {
+        if (fadeSamplesLeft > 0)
+            return;
+        keyIsDown = false;
+        sustainPedalDown = false;
+        fadeSamplesLeft = juce::jmax(1, numSamples);
+        fadeGain = 1.0f;
+        fadeStep = 1.0f / fadeSamplesLeft;
+    }
+    bool isFadingOut() const { return fadeSamplesLeft > 0; }
 
-    void aftertouchChanged(int newAftertouchValue) override
+    void pitchWheelMoved(int newPitchWheelValue) { xenos.setBend(newPitchWheelValue); }
+
+    void aftertouchChanged(int newAftertouchValue)
     {
         afterTouchAmount = newAftertouchValue / 127.0;
+        wakeUp();
+    }
+
+    bool isVoiceActive() const { return currentNote >= 0; }
+    int getCurrentlyPlayingNote() const { return currentNote; }
+    bool isPlayingChannel(int channel) const { return currentChannel == channel; }
+    void clearCurrentNote()
+    {
+        currentNote = -1;
+        keyIsDown = false;
+        sustainPedalDown = false;
+        fadeSamplesLeft = 0;
+        wakeUp();
+    }
+
+    // returns value in range 0.0 to 1.0, 0.5 center
+    float getPanPositionFromMidiKey(int key)
+    {
+        const float positions[3] = {0.0f, 0.5f, 1.0f};
+        if (vpm == VoicePanMode::AltLeftRight)
+            return (float)(key % 2);
+        else if (vpm == VoicePanMode::AltLeftCenterRight)
+            return positions[key % 3];
+        else if (vpm == VoicePanMode::Random)
+            return panDistribution(panRng);
+        else if (vpm == VoicePanMode::Sine1Cycle)
+            return 0.5 + 0.5 * std::sin(2 * juce::MathConstants<float>::pi / 128 * key * 5.0f);
+        else if (vpm == VoicePanMode::Sine2Cycles)
+            return 0.5 + 0.5 * std::sin(2 * juce::MathConstants<float>::pi / 128 * key * 10.0f);
+        else if (vpm == VoicePanMode::AltLeftRight2 && noteCounter != nullptr)
+            return (*noteCounter) % 2;
+        else if (vpm == VoicePanMode::AltLeftCenterRight2 && noteCounter != nullptr)
+            return positions[(*noteCounter) % 3];
+        return 0.5f;
     }
+
     float cachedPanPosition = 0.5f;
-    void renderNextBlock(juce::AudioSampleBuffer &outputBuffer, int startSample,
-                         int numSamples) override
+    // Adds the voice into the output channels, outRight may be null for mono output
+    void renderNextBlock(float *outLeft, float *outRight, int startSample, int numSamples)
     {
+        if (parked)
+            return;
+        XENOS_TRACE_SCOPE("XenosVoice::renderNextBlock");
         if (adsr.isActive())
         {
+            // The voice is rendered in mono into the scratch block one control block at a time,
+            // the envelope and gains are then applied and the block is panned into the output
+            // with the vector operations
+            controlBlocks.process(
+                numSamples, [this]() { updateControlBlock(); },
+                [&](int offset, int n) {
+                    return renderSubBlock(outLeft, outRight, startSample + offset, n);
+                });
+        }
+        if (!adsr.isActive())
+        {
+            clearCurrentNote();
+        }
+    }
 
-            float atVolume = juce::jmap(afterTouchAmount, 0.0f, 1.0f, 0.0f, 10.0f);
-            atVolume = juce::Decibels::decibelsToGain(atVolume);
+    // control-rate work, done once per SRProvider::BLOCK_SIZE samples
+    void updateControlBlock()
+    {
+        static constexpr float lfo_pars0[4] = {1.0f, 3.0f, 0.25f, 5.0f};
+        static constexpr float lfo_pars1[4] = {0.75f, 0.45f, 0.20f, 0.95f};
+        CycleStopwatch watch(countCycles);
 
-            const float lfo_pars0[4] = {1.0f, 3.0f, 0.25f, 5.0f};
-            const float lfo_pars1[4] = {0.75f, 0.45f, 0.20f, 0.95f};
+        xenos.updateTuning();
+        watch.lap(cycles[dssStage]);
 
-            int panlfomode = (int)vpm - (int)VoicePanMode::RandomPerVoice1;
-            while (--numSamples >= 0)
+        float atVolume = juce::jmap(afterTouchAmount, 0.0f, 1.0f, 0.0f, 10.0f);
+        atVolume = juce::Decibels::decibelsToGain(atVolume);
+        controlGain = polyGainFactor * atVolume;
+
+        const int panlfomode = (int)vpm - (int)VoicePanMode::RandomPerVoice1;
+        panModulated = panlfomode >= 0 && panlfomode < 4;
+        if (panModulated)
+        {
+            // the pan law is applied per sample over the whole LFO block
+            lfo1->process_block(lfo_pars0[panlfomode], lfo_pars1[panlfomode],
+                                LFOType::Shape::SMOOTH_NOISE, false);
+            for (int i = 0; i < SRProvider::BLOCK_SIZE; ++i)
+                panBlock[i] = 0.5f + 0.5f * lfo1->outputBlock[i];
+            equal_power_pan::processBlock(panBlock, panLeftBlock, panRightBlock,
+                                          SRProvider::BLOCK_SIZE);
+            cachedPanPosition = panBlock[0];
+        }
+        else
+        {
+            cachedPanPosition = getPanPositionFromMidiKey(currentNote);
+            sst::basic_blocks::dsp::pan_laws::monoEqualPower(cachedPanPosition, panmatrix);
+        }
+        watch.lap(cycles[panStage]);
+    }
+
+    // Renders n samples, at most to the end of the current control block. Returns false once the
+    // voice has finished or gone to sleep.
+    bool renderSubBlock(float *outLeft, float *outRight, int startSample, int n)
+    {
+        CycleStopwatch watch(countCycles);
+        const auto envelope = adsr.process(envelopeBlock, n);
+        watch.lap(cycles[envelopeStage]);
+        if (envelope == BlockADSR::BlockKind::Idle)
+            return false;
+        for (int i = 0; i < n; ++i)
+            renderBlock[i] = xenos();
+        watch.lap(cycles[dssStage]);
+        // on the sustain plateau the envelope is folded into the gain
+        if (envelope == BlockADSR::BlockKind::Ramp)
+        {
+            juce::FloatVectorOperations::multiply(renderBlock, envelopeBlock, n);
+            juce::FloatVectorOperations::multiply(renderBlock, controlGain, n);
+        }
+        else
+        {
+            juce::FloatVectorOperations::multiply(renderBlock, controlGain * adsr.getLevel(), n);
+        }
+        lastEnvelopeLevel = adsr.getLevel();
+        bool fadedOut = false;
+        if (fadeSamplesLeft > 0)
+        {
+            const int m = std::min(n, fadeSamplesLeft);
+            for (int i = 0; i < m; ++i)
             {
-                if (lfo_updatecounter == 0)
-                {
-                    float panposition = 0.5f;
-                    if (panlfomode >= 0 && panlfomode < 4)
-                    {
-                        lfo1->process_block(lfo_pars0[panlfomode], lfo_pars1[panlfomode],
-                                            LFOType::Shape::SMOOTH_NOISE, false);
-                        // we use only the first value from the LFO output block, which is a bit
-                        // wasteful but we'd need to do the pan law calculation per sample if we
-                        // used all the LFO output...
-                        panposition = 0.5f + 0.5f * lfo1->outputBlock[0];
-                    }
-                    else
-                    {
-                        auto xsnd = dynamic_cast<XenosSound *>(getCurrentlyPlayingSound().get());
-                        panposition = xsnd->getPanPositionFromMidiKey(getCurrentlyPlayingNote(),
-                                                                      vpm, noteCounter);
-                    }
-                    sst::basic_blocks::dsp::pan_laws::monoEqualPower(panposition, panmatrix);
-                    cachedPanPosition = panposition;
-                }
-                ++lfo_updatecounter;
-                if (lfo_updatecounter == srprovider->BLOCK_SIZE)
-                    lfo_updatecounter = 0;
-                float gainLeft = panmatrix[0];
-                float gainRight = panmatrix[3];
-                auto currentSample = xenos() * adsr.getNextSample() * polyGainFactor * atVolume;
-                // for (auto i = outputBuffer.getNumChannels(); --i >= 0;)
-                outputBuffer.addSample(0, startSample, currentSample * gainLeft);
-                outputBuffer.addSample(1, startSample, currentSample * gainRight);
-                ++startSample;
+                renderBlock[i] *= fadeGain;
+                fadeGain -= fadeStep;
             }
+            lastEnvelopeLevel *= fadeGain;
+            fadeSamplesLeft -= m;
+            fadedOut = fadeSamplesLeft == 0;
+            n = m;
+        }
+        watch.lap(cycles[envelopeStage]);
+        if (panModulated)
+        {
+            const int pos = controlBlocks.getPositionInBlock();
+            juce::FloatVectorOperations::addWithMultiply(outLeft + startSample, renderBlock,
+                                                         panLeftBlock + pos, n);
+            if (outRight)
+                juce::FloatVectorOperations::addWithMultiply(outRight + startSample, renderBlock,
+                                                             panRightBlock + pos, n);
         }
         else
         {
-            clearCurrentNote();
+            juce::FloatVectorOperations::addWithMultiply(outLeft + startSample, renderBlock,
+                                                         panmatrix[0], n);
+            if (outRight)
+                juce::FloatVectorOperations::addWithMultiply(outRight + startSample, renderBlock,
+                                                             panmatrix[3], n);
+        }
+        watch.lap(cycles[panStage]);
+        if (fadedOut)
+        {
+            adsr.reset();
+            return false;
+        }
+        if (updateSleep(n))
+        {
+            if (adsr.getStage() == BlockADSR::Stage::release)
+                adsr.reset();
+            else
+                parked = true;
+            return false;
+        }
+        return true;
+    }
+
+    // true when the voice has been inaudible for long enough to go to sleep
+    bool updateSleep(int numRendered)
+    {
+        const auto stage = adsr.getStage();
+        if (sleepThreshold <= 0.0f || fadeSamplesLeft > 0 ||
+            (stage != BlockADSR::Stage::sustain && stage != BlockADSR::Stage::release))
+        {
+            silentSamples = 0;
+            return false;
+        }
+        auto range = juce::FloatVectorOperations::findMinAndMax(renderBlock, numRendered);
+        if (std::max(-range.getStart(), range.getEnd()) >= sleepThreshold)
+        {
+            silentSamples = 0;
+            return false;
         }
+        silentSamples += numRendered;
+        return silentSamples >= sleepHoldSamples;
     }
 
     XenosCore xenos;
-    juce::ADSR adsr;
+    BlockADSR adsr;
     using LFOType = sst::basic_blocks::modulators::SimpleLFO<SRProvider, 32>;
     std::unique_ptr<LFOType> lfo1;
     VoicePanMode vpm = VoicePanMode::AlwaysCenter;
@@ -377,213 +545,1102 @@ struct XenosVoice : public juce::SynthesiserVoice
     int *noteCounter = nullptr;
     float afterTouchAmount = 0.0f;
     float a = 0.1f, d = 0.1f, s = 1.0f, r = 0.1f;
+    // relative to the default polyphony, so the level doesn't depend on the polyphony setting
     const double polyGainFactor = 1 / sqrt(NUM_VOICES / 4);
-    int lfo_updatecounter = 0;
+    SubBlockScheduler controlBlocks;
+    float controlGain = 0.0f;
+    bool panModulated = false;
+    std::minstd_rand panRng;
+    std::uniform_real_distribution<float> panDistribution{0.0f, 1.0f};
+
+    int currentNote = -1;
+    int currentChannel = 0;
+    bool keyIsDown = false;
+    bool sustainPedalDown = false;
+    // envelope level at the end of the last rendered block, used for picking a voice to steal
+    float lastEnvelopeLevel = 0.0f;
+    int fadeSamplesLeft = 0;
+    float fadeGain = 1.0f, fadeStep = 0.0f;
+    float sleepThreshold = 0.0f;
+    static constexpr double sleepHoldSeconds = 0.05;
+    int sleepHoldSamples = 2205;
+    int silentSamples = 0;
+    bool parked = false;
+    // the voice's index in the synth's pool, set by XenosSynth
+    int voiceId = -1;
+    // Where the voice's cycles go, see XenosSynth::getCpuStats. They're counted here while
+    // countCycles is set and collected by the synth after every block.
+    enum CycleStage
+    {
+        dssStage,
+        envelopeStage,
+        panStage,
+        numCycleStages
+    };
+    bool countCycles = false;
+    std::array<juce::int64, numCycleStages> cycles{};
+    // links maintained by XenosSynth
+    XenosVoice *prevActive = nullptr;
+    XenosVoice *nextActive = nullptr;
+    XenosVoice *nextFree = nullptr;
+
+    alignas(16) float renderBlock[SRProvider::BLOCK_SIZE];
+    alignas(16) float envelopeBlock[SRProvider::BLOCK_SIZE];
+    // pan positions and gains for the current LFO block in the modulated pan modes
+    alignas(16) float panBlock[SRProvider::BLOCK_SIZE] = {};
+    alignas(16) float panLeftBlock[SRProvider::BLOCK_SIZE] = {};
+    alignas(16) float panRightBlock[SRProvider::BLOCK_SIZE] = {};
 };
 
 //==============================================================================
-class XenosSynth : public juce::Synthesiser
+// Voice allocation and MIDI handling for Xenos, in place of juce::Synthesiser. The voices are
+// kept in one array, the playing ones are also linked into an active list in the order they
+// were started, and the idle ones into a free list. Rendering only walks the active list and
+// starting a note takes a voice from the free list in O(1). When no voice is free, the quietest
+// voice already in its release is stolen, or the oldest voice if none is releasing.
+//
+// Nothing here takes a lock. Events from the on-screen keyboard arrive through a single
+// producer FIFO written by the message thread and are applied at the start of the next block.
+//
+// With a VoiceRenderPool set, the active voices are split between its threads when there are
+// enough of them to make it worthwhile.
+//
+// The polyphony is a hard limit on the voices sounding at once. The pool of voices can grow
+// up to MAX_VOICES while playing, room for the voice pointers is reserved up front. Below the
+// polyphony, a VoiceGovernor can lower the ceiling when the measured load goes over the CPU
+// budget. Voices above the ceiling, and voices taken over by new notes while at the ceiling,
+// are faded out over a few milliseconds.
+class XenosSynth : private VoiceRenderPool::Job
 {
   public:
-    void noteOn(const int midiChannel, const int midiNoteNumber, const float velocity)
+    XenosSynth()
     {
-        const juce::ScopedLock sl(lock);
+        keyboardEvents.reset(256);
+        voices.reserve(MAX_VOICES);
+        activeVoices.assign(MAX_VOICES, nullptr);
+    }
+
+    template <typename... Args>
+    static std::vector<std::unique_ptr<XenosVoice>> createVoices(int numVoices,
+                                                                 const Args &...voiceArgs)
+    {
+        std::vector<std::unique_ptr<XenosVoice>> result;
+        for (int i = 0; i < numVoices; ++i)
+            result.push_back(std::make_unique<XenosVoice>(voiceArgs...));
+        return result;
+    }
+
+    template <typename... Args> void initVoices(int numVoices, const Args &...voiceArgs)
+    {
+        voices.clear();
+        activeHead = activeTail = nullptr;
+        freeHead = nullptr;
+        numActiveVoices = 0;
+        auto newVoices = createVoices(numVoices, voiceArgs...);
+        addVoices(newVoices);
+        polyphony = numVoices;
+    }
 
-        for (auto *sound : sounds)
+    // Moves voices made by createVoices into the pool, as far as MAX_VOICES allows. It doesn't
+    // allocate, but it mustn't run at the same time as the audio callback.
+    void addVoices(std::vector<std::unique_ptr<XenosVoice>> &newVoices)
+    {
+        // linked in reverse, so the free list hands the voices out in pool order
+        const int numToAdd = juce::jmin((int)newVoices.size(), MAX_VOICES - getNumVoices());
+        for (int i = numToAdd; --i >= 0;)
+        {
+            newVoices[i]->nextFree = freeHead;
+            freeHead = newVoices[i].get();
+        }
+        for (int i = 0; i < numToAdd; ++i)
         {
-            if (sound->appliesToNote(midiNoteNumber) && sound->appliesToChannel(midiChannel))
+            newVoices[i]->voiceId = getNumVoices();
+            voices.push_back(std::move(newVoices[i]));
+        }
+        newVoices.clear();
+    }
+
+    int getNumVoices() const { return (int)voices.size(); }
+    XenosVoice *getVoice(int index) { return voices[index].get(); }
+    int getNumActiveVoices() const { return numActiveVoices; }
+
+    // the most voices that may sound at once, beyond the pool size the pool is the limit
+    void setPolyphony(int numVoices) { polyphony = juce::jlimit(1, MAX_VOICES, numVoices); }
+    int getPolyphony() const { return polyphony; }
+    VoiceGovernor &getGovernor() { return governor; }
+    const VoiceGovernor &getGovernor() const { return governor; }
+    // the audio callback's load, as a proportion of the block duration, fed to the governor
+    void setMeasuredLoad(float load) { measuredLoad = load; }
+    // the ceiling from the last block, may be read from any thread
+    int getVoiceCeiling() const { return governor.getCeiling(); }
+
+    // Returns the previous pool, so that it can be destroyed outside the audio callback lock.
+    // A null pool renders everything on the audio thread.
+    std::unique_ptr<VoiceRenderPool> setRenderPool(std::unique_ptr<VoiceRenderPool> pool)
+    {
+        std::swap(pool, renderPool);
+        return pool;
+    }
+    VoiceRenderPool *getRenderPool() const { return renderPool.get(); }
+    // below this many voices per thread the pool isn't worth waking up
+    static constexpr int minVoicesPerThread = 8;
+
+    void setCurrentPlaybackSampleRate(double sampleRate)
+    {
+        for (auto &v : voices)
+            v->setCurrentPlaybackSampleRate(sampleRate);
+        fadeOutSamples = juce::jmax(1, juce::roundToInt(sampleRate * fadeOutSeconds));
+        scopeFeed.prepare(sampleRate);
+    }
+
+    void prepareGovernor(double sampleRate, int samplesPerBlock)
+    {
+        governor.prepare(sampleRate / juce::jmax(1, samplesPerBlock));
+    }
+
+    // May only be called from one thread at a time, normally the message thread. Nothing is
+    // dropped, a note-off least of all: what doesn't fit in the FIFO, while the device is
+    // stopped for instance, waits in a backlog, where a note-off cancels its note-on.
+    void pushKeyboardEvent(const juce::MidiMessage &message)
+    {
+        auto raw = message.getRawData();
+        KeyboardEvent ev;
+        jassert(message.getRawDataSize() <= 3);
+        ev.numBytes = (uint8_t)std::min(message.getRawDataSize(), 3);
+        for (int i = 0; i < ev.numBytes; ++i)
+            ev.bytes[i] = raw[i];
+        flushKeyboardBacklog();
+        if (keyboardBacklog.empty() && keyboardEvents.push(ev))
+            return;
+        if (message.isNoteOff())
+        {
+            // a note-on that never reached the synth can't sound, neither needs to be sent
+            for (auto it = keyboardBacklog.rbegin(); it != keyboardBacklog.rend(); ++it)
             {
-                juce::SynthesiserVoice *voice =
-                    findFreeVoice(sound, midiChannel, midiNoteNumber, isNoteStealingEnabled());
-                startVoice(voice, sound, midiChannel, midiNoteNumber, velocity);
-                ++noteCounter;
+                if (it->isNoteOnFor(ev))
+                {
+                    keyboardBacklog.erase(std::next(it).base());
+                    return;
+                }
             }
         }
+        keyboardBacklog.push_back(ev);
+    }
+    // Same thread as pushKeyboardEvent, moves the backlog on as far as the FIFO has room
+    void flushKeyboardBacklog()
+    {
+        size_t numMoved = 0;
+        while (numMoved < keyboardBacklog.size() && keyboardEvents.push(keyboardBacklog[numMoved]))
+            ++numMoved;
+        keyboardBacklog.erase(keyboardBacklog.begin(), keyboardBacklog.begin() + (long)numMoved);
     }
-    int noteCounter = 0;
 
-  private:
-};
+    // Once at the start of every block, before its events and rendering
+    void beginBlock()
+    {
+        countCycles = cpuStats.isEnabled();
+        updateVoiceCeiling();
+        KeyboardEvent ev;
+        while (keyboardEvents.pop(ev))
+            handleMidiEvent(juce::MidiMessage(ev.bytes, ev.numBytes));
+    }
 
-//==============================================================================
-class XenosSynthHolder
-{
-  public:
-    SRProvider srProvider;
-    Quantizer2 sharedquantizer;
-    Tunings::KeyboardMapping sharedKBM;
-    XenosSynthHolder(juce::MidiKeyboardState &keyState) : keyboardState(keyState)
+    // Nothing to render: every voice is free or parked and no keyboard notes are waiting.
+    // A parked voice stays silent until a note, a controller or a parameter wakes it up.
+    bool isIdle() const
     {
-        sharedKBM = Tunings::startScaleOnAndTuneNoteTo(69, 69, 440.0);
-        for (auto i = 0; i < NUM_VOICES; ++i)
-            xenosSynth.addVoice(
-                new XenosVoice(&xenosSynth.noteCounter, &srProvider, &sharedquantizer));
+        if (keyboardEvents.getUsedSlots() > 0)
+            return false;
+        for (auto *v = activeHead; v != nullptr; v = v->nextActive)
+            if (!v->isParked())
+                return false;
+        return true;
+    }
+
+    // Audio thread, at the end of every block: what the GUI shows of the voices
+    void publishTelemetry()
+    {
+        auto &snapshot = telemetry.beginWrite();
+        int n = 0;
+        for (auto *v = activeHead; v != nullptr; v = v->nextActive)
+        {
+            if (!v->isVoiceActive())
+                continue;
+            auto &t = snapshot.voices[n++];
+            t.hz = (float)v->xenos.curQuantizedHz;
+            t.pan = v->cachedPanPosition;
+            t.level = v->isParked() ? 0.0f : v->lastEnvelopeLevel;
+        }
+        snapshot.numVoices = n;
+        telemetry.endWrite();
+    }
+    // Audio thread, after the block was rendered: the breakpoints of the voices whose cycle
+    // wrapped, while the editor's scope is showing
+    void publishBreakpoints(int numSamples)
+    {
+        if (!scopeFeed.isDue(numSamples))
+            return;
+        const bool newestOnly =
+            scopeFeed.getSelection() == BreakpointScopeFeed::Selection::newestVoice;
+        for (auto *v = newestOnly ? activeTail : activeHead; v != nullptr; v = v->nextActive)
+        {
+            if (!v->xenos.cycleWrapped || v->isParked() || !v->isVoiceActive())
+                continue;
+            v->xenos.cycleWrapped = false;
+            v->xenos.getBreakpoints(scopeSnapshot);
+            scopeSnapshot.voiceId = v->voiceId;
+            scopeSnapshot.note = v->getCurrentlyPlayingNote();
+            if (!scopeFeed.push(scopeSnapshot))
+                break;
+        }
+    }
+    BreakpointScopeFeed &getScopeFeed() { return scopeFeed; }
 
-        xenosSynth.addSound(new XenosSound());
+    // The cycles of the voices' DSS, envelope and pan stages, per voice in the pool, while
+    // counting is enabled
+    using CpuStats = CycleAccounting<MAX_VOICES, XenosVoice::numCycleStages>;
+    CpuStats &getCpuStats() { return cpuStats; }
+    // Audio thread, after the block was rendered
+    void publishCycles(int numSamples)
+    {
+        if (countCycles)
+            cpuStats.endBlock(numSamples);
     }
 
-    void setUsingSineWaveSound() { xenosSynth.clearSounds(); }
+    using Telemetry = VoiceTelemetry<MAX_VOICES>;
+    // GUI thread, see VoiceTelemetry::read()
+    const Telemetry::Snapshot &readTelemetry() { return telemetry.read(); }
 
-    void prepareToPlay(int /*samplesPerBlockExpected*/, double sampleRate)
+    // Renders a run of samples with no events in it, the caller splits the block at the events
+    void renderNextBlock(juce::AudioBuffer<float> &outputBuffer, int startSample, int numSamples)
     {
-        srProvider.samplerate = sampleRate;
-        srProvider.initTables();
-        xenosSynth.setCurrentPlaybackSampleRate(sampleRate);
+        renderActiveVoices(outputBuffer, startSample, numSamples);
     }
 
-    void processBlock(juce::AudioBuffer<float> &buffer, juce::MidiBuffer &midiMessages)
+    void handleMidiEvent(const juce::MidiMessage &m)
     {
-        buffer.clear();
-        keyboardState.processNextMidiBuffer(midiMessages, 0, buffer.getNumSamples(), true);
-        xenosSynth.renderNextBlock(buffer, midiMessages, 0, buffer.getNumSamples());
+        const int channel = m.getChannel();
+        if (m.isNoteOn())
+        {
+            noteOn(channel, m.getNoteNumber(), m.getFloatVelocity());
+        }
+        else if (m.isNoteOff())
+        {
+            noteOff(channel, m.getNoteNumber(), m.getFloatVelocity(), true);
+        }
+        else if (m.isAllNotesOff() || m.isAllSoundOff())
+        {
+            allNotesOff(channel, true);
+        }
+        else if (m.isPitchWheel())
+        {
+            const int wheelPos = m.getPitchWheelValue();
+            lastPitchWheelValues[channel] = wheelPos;
+            for (auto *v = activeHead; v != nullptr; v = v->nextActive)
+                if (v->isPlayingChannel(channel))
+                    v->pitchWheelMoved(wheelPos);
+        }
+        else if (m.isAftertouch())
+        {
+            for (auto *v = activeHead; v != nullptr; v = v->nextActive)
+                if (v->getCurrentlyPlayingNote() == m.getNoteNumber() &&
+                    v->isPlayingChannel(channel))
+                    v->aftertouchChanged(m.getAfterTouchValue());
+        }
+        else if (m.isSustainPedalOn())
+        {
+            handleSustainPedal(channel, true);
+        }
+        else if (m.isSustainPedalOff())
+        {
+            handleSustainPedal(channel, false);
+        }
     }
 
-    void setParam(const juce::String &parameterID, float newValue)
+    void noteOn(const int midiChannel, const int midiNoteNumber, const float velocity)
     {
-        for (int i = 0; i < xenosSynth.getNumVoices(); ++i)
+        // a retriggered note releases the voice that was already playing it
+        for (auto *v = activeHead; v != nullptr; v = v->nextActive)
         {
-            auto voice = dynamic_cast<XenosVoice *>(xenosSynth.getVoice(i));
-            XenosCore &xenos = voice->xenos;
-            if (parameterID == "voicePanningMode")
+            if (v->getCurrentlyPlayingNote() == midiNoteNumber && v->isPlayingChannel(midiChannel))
             {
-                voice->vpm = (VoicePanMode)(int)newValue;
-                // DBG("voice pan mode " << newValue);
+                v->keyIsDown = false;
+                v->stopNote(1.0f, true);
             }
+        }
+        // at the ceiling the new note takes over from a playing voice, which fades out
+        if (countSoundingVoices() >= voiceCeiling)
+        {
+            if (auto *victim = findVoiceToSteal())
+                victim->startFadeOut(fadeOutSamples);
+        }
+        auto *voice = takeFreeVoice();
+        if (!voice)
+        {
+            // with the whole pool in use there's no time for a fade
+            voice = findSilentVoice();
+            if (!voice)
+                voice = findVoiceToSteal();
+            removeFromActiveList(voice);
+            voice->clearCurrentNote();
+        }
+        voice->startNote(midiNoteNumber, midiChannel, velocity, lastPitchWheelValues[midiChannel]);
+        addToActiveList(voice);
+        ++noteCounter;
+    }
 
-            if (parameterID == "segments")
-            {
-                xenos.nPoints_ = newValue;
-            }
-            if (parameterID == "pitchWidth")
-            {
-                xenos.pitchWidthKeys = newValue;
-                if (voice->isVoiceActive())
-                    xenos.calcMetaParams();
-            }
-            if (parameterID == "pitchBarrier")
-            {
-                xenos.pitchWalk.setBarrierRatio(newValue);
-            }
-            if (parameterID == "pitchStep")
-            {
-                xenos.pitchWalk.setStepRatio(newValue);
-            }
-            if (parameterID == "ampGain")
-            {
-                auto linear = juce::Decibels::decibelsToGain(newValue, -96.0f);
-                xenos.ampWalk.setSecBarriers(linear);
-                xenos.ampWalk.calcPriBarriers();
-                xenos.ampWalk.calcPriStepSize();
-            }
-            if (parameterID == "ampBarrier")
-            {
-                xenos.ampWalk.setBarrierRatio(newValue);
-            }
-            if (parameterID == "ampStep")
+    void noteOff(const int midiChannel, const int midiNoteNumber, const float velocity,
+                 bool allowTailOff)
+    {
+        for (auto *v = activeHead; v != nullptr; v = v->nextActive)
+        {
+            if (v->getCurrentlyPlayingNote() == midiNoteNumber &&
+                v->isPlayingChannel(midiChannel) && v->keyIsDown)
             {
-                xenos.ampWalk.setStepRatio(newValue);
+                v->keyIsDown = false;
+                if (sustainPedalsDown[midiChannel])
+                    v->sustainPedalDown = true;
+                else
+                    v->stopNote(velocity, allowTailOff);
             }
+        }
+    }
 
-            if (parameterID == "pitchDistribution")
-            {
-                xenos.pitchSource.setMode(newValue);
-            }
-            if (parameterID == "pitchWalk")
-            {
-                xenos.pitchWalk.setWalk(newValue);
-            }
-            if (parameterID == "pitchAlpha")
-            {
-                xenos.pitchSource.setAlpha(newValue);
-            }
-            if (parameterID == "pitchBeta")
+    void allNotesOff(const int midiChannel, bool allowTailOff)
+    {
+        for (auto *v = activeHead; v != nullptr; v = v->nextActive)
+        {
+            if (midiChannel <= 0 || v->isPlayingChannel(midiChannel))
             {
-                xenos.pitchSource.setBeta(newValue);
+                v->keyIsDown = false;
+                v->sustainPedalDown = false;
+                v->stopNote(1.0f, allowTailOff);
             }
+        }
+        if (midiChannel <= 0)
+            std::fill(std::begin(sustainPedalsDown), std::end(sustainPedalsDown), false);
+        else
+            sustainPedalsDown[midiChannel] = false;
+    }
 
-            if (parameterID == "ampDistribution")
-            {
-                xenos.ampSource.setMode(newValue);
-            }
-            if (parameterID == "ampWalk")
-            {
-                xenos.ampWalk.setWalk(newValue);
-            }
-            if (parameterID == "ampAlpha")
+    int noteCounter = 0;
+
+  private:
+    struct KeyboardEvent
+    {
+        uint8_t bytes[3] = {0, 0, 0};
+        uint8_t numBytes = 0;
+        // a note-on for the channel and key of a note-off
+        bool isNoteOnFor(const KeyboardEvent &noteOff) const
+        {
+            return (bytes[0] & 0xf0) == 0x90 && bytes[2] != 0 &&
+                   (bytes[0] & 0x0f) == (noteOff.bytes[0] & 0x0f) &&
+                   bytes[1] == noteOff.bytes[1];
+        }
+    };
+
+    void updateVoiceCeiling()
+    {
+        const int limit = juce::jmin(polyphony.load(), getNumVoices());
+        int numSounding = countSoundingVoices();
+        voiceCeiling = governor.update(measuredLoad.load(), numSounding, limit);
+        while (numSounding > voiceCeiling)
+        {
+            auto *v = findVoiceToSteal();
+            if (!v)
+                break;
+            v->startFadeOut(fadeOutSamples);
+            --numSounding;
+        }
+    }
+
+    int countSoundingVoices() const
+    {
+        int result = 0;
+        for (auto *v = activeHead; v != nullptr; v = v->nextActive)
+            if (!v->isFadingOut() && !v->isParked())
+                ++result;
+        return result;
+    }
+
+    void handleSustainPedal(int midiChannel, bool isDown)
+    {
+        sustainPedalsDown[midiChannel] = isDown;
+        for (auto *v = activeHead; v != nullptr; v = v->nextActive)
+        {
+            if (!v->isPlayingChannel(midiChannel))
+                continue;
+            if (isDown)
             {
-                xenos.ampSource.setAlpha(newValue);
+                v->sustainPedalDown = v->keyIsDown;
             }
-            if (parameterID == "ampBeta")
+            else if (v->sustainPedalDown)
             {
-                xenos.ampSource.setBeta(newValue);
+                v->sustainPedalDown = false;
+                v->stopNote(1.0f, true);
             }
+        }
+    }
 
-            if (parameterID == "attack")
+    void renderActiveVoices(juce::AudioBuffer<float> &outputBuffer, int startSample,
+                            int numSamples)
+    {
+        float *outLeft = outputBuffer.getWritePointer(0);
+        float *outRight =
+            outputBuffer.getNumChannels() > 1 ? outputBuffer.getWritePointer(1) : nullptr;
+        int threadsToUse = 1;
+        if (renderPool && numSamples <= renderPool->getMaxBlockSize())
+            threadsToUse = juce::jmin(renderPool->getNumThreads(),
+                                      numActiveVoices / minVoicesPerThread);
+        if (threadsToUse > 1)
+        {
+            int n = 0;
+            for (auto *v = activeHead; v != nullptr; v = v->nextActive)
             {
-                voice->a = newValue;
-                voice->updateADSR();
+                v->countCycles = countCycles;
+                activeVoices[n++] = v;
             }
-            if (parameterID == "decay")
+            renderPool->render(*this, n, threadsToUse, outLeft + startSample,
+                               outRight ? outRight + startSample : nullptr, numSamples);
+        }
+        else
+        {
+            for (auto *v = activeHead; v != nullptr; v = v->nextActive)
             {
-                voice->d = newValue;
-                voice->updateADSR();
+                v->countCycles = countCycles;
+                v->renderNextBlock(outLeft, outRight, startSample, numSamples);
             }
-            if (parameterID == "sustain")
+        }
+        for (auto *v = activeHead; v != nullptr;)
+        {
+            auto *next = v->nextActive;
+            if (countCycles)
             {
-                auto linear = juce::Decibels::decibelsToGain(newValue, -96.0f);
-                voice->s = linear;
-                voice->updateADSR();
+                cpuStats.add(v->voiceId, v->cycles);
+                v->cycles = {};
             }
-            if (parameterID == "release")
+            if (!v->isVoiceActive())
             {
-                voice->r = newValue;
-                voice->updateADSR();
+                removeFromActiveList(v);
+                v->nextFree = freeHead;
+                freeHead = v;
             }
+            v = next;
+        }
+    }
 
-            if (parameterID == "scale")
-            {
-                if (newValue == 0)
-                {
-                    xenos.quantizer.setActive(0);
-                    sharedquantizer.active = false;
-                }
-                else
-                {
-                    sharedquantizer.setScale(newValue - 1, sharedKBM);
-                    sharedquantizer.active = true;
-                    xenos.quantizer.setScale(newValue - 1);
-                    xenos.quantizer.setActive(1);
-                }
-            }
-            if (parameterID == "root")
+    // called by the render pool threads, each with its own range of voices and buffers
+    void renderVoices(int first, int last, float *left, float *right, int numSamples) override
+    {
+        for (int i = first; i < last; ++i)
+            activeVoices[i]->renderNextBlock(left, right, 0, numSamples);
+    }
+
+    XenosVoice *takeFreeVoice()
+    {
+        auto *v = freeHead;
+        if (v)
+            freeHead = v->nextFree;
+        return v;
+    }
+
+    // Voices already fading out or parked are left alone, returns null if there are only those
+    XenosVoice *findVoiceToSteal()
+    {
+        XenosVoice *quietest = nullptr;
+        XenosVoice *oldest = nullptr;
+        for (auto *v = activeHead; v != nullptr; v = v->nextActive)
+        {
+            if (v->isFadingOut() || v->isParked())
+                continue;
+            // the active list is in start order, so the first one found is the oldest
+            if (!oldest)
+                oldest = v;
+            if (v->keyIsDown || v->sustainPedalDown)
+                continue;
+            if (!quietest || v->lastEnvelopeLevel < quietest->lastEnvelopeLevel)
+                quietest = v;
+        }
+        return quietest ? quietest : oldest;
+    }
+
+    // a parked voice if there is one, else one that's fading out
+    XenosVoice *findSilentVoice()
+    {
+        XenosVoice *fading = nullptr;
+        for (auto *v = activeHead; v != nullptr; v = v->nextActive)
+        {
+            if (v->isParked())
+                return v;
+            if (!fading && v->isFadingOut())
+                fading = v;
+        }
+        return fading;
+    }
+
+    void addToActiveList(XenosVoice *v)
+    {
+        v->prevActive = activeTail;
+        v->nextActive = nullptr;
+        if (activeTail)
+            activeTail->nextActive = v;
+        else
+            activeHead = v;
+        activeTail = v;
+        ++numActiveVoices;
+    }
+
+    void removeFromActiveList(XenosVoice *v)
+    {
+        if (v->prevActive)
+            v->prevActive->nextActive = v->nextActive;
+        else
+            activeHead = v->nextActive;
+        if (v->nextActive)
+            v->nextActive->prevActive = v->prevActive;
+        else
+            activeTail = v->prevActive;
+        v->prevActive = v->nextActive = nullptr;
+        --numActiveVoices;
+    }
+
+    std::vector<std::unique_ptr<XenosVoice>> voices;
+    // the active list flattened for splitting between the render threads
+    std::vector<XenosVoice *> activeVoices;
+    std::unique_ptr<VoiceRenderPool> renderPool;
+    std::atomic<int> polyphony{NUM_VOICES};
+    std::atomic<float> measuredLoad{0.0f};
+    VoiceGovernor governor;
+    int voiceCeiling = NUM_VOICES;
+    static constexpr double fadeOutSeconds = 0.005;
+    int fadeOutSamples = 220;
+    XenosVoice *activeHead = nullptr;
+    XenosVoice *activeTail = nullptr;
+    XenosVoice *freeHead = nullptr;
+    int numActiveVoices = 0;
+    // indexed by MIDI channel 1-16
+    int lastPitchWheelValues[17] = {0x2000, 0x2000, 0x2000, 0x2000, 0x2000, 0x2000,
+                                    0x2000, 0x2000, 0x2000, 0x2000, 0x2000, 0x2000,
+                                    0x2000, 0x2000, 0x2000, 0x2000, 0x2000};
+    bool sustainPedalsDown[17] = {};
+    choc::fifo::SingleReaderSingleWriterFIFO<KeyboardEvent> keyboardEvents;
+    // the keyboard events waiting for room in the FIFO, pushKeyboardEvent's thread only
+    std::vector<KeyboardEvent> keyboardBacklog;
+    Telemetry telemetry;
+    BreakpointScopeFeed scopeFeed;
+    BreakpointSnapshot scopeSnapshot;
+    CpuStats cpuStats;
+    bool countCycles = false;
+};
+
+//==============================================================================
+class XenosSynthHolder : public juce::MidiKeyboardState::Listener, private juce::Timer
+{
+  public:
+    SRProvider srProvider;
+    Quantizer2 sharedquantizer;
+    Tunings::KeyboardMapping sharedKBM;
+    juce::SharedResourcePointer<ScaleStore> scaleStore;
+    Scale customScale;
+    QuantizerSettings quantizerSettings;
+    XenosWalkParams walkParams;
+    XenosSynthHolder(juce::MidiKeyboardState &keyState) : keyboardState(keyState)
+    {
+        // sharedquantizer has compiled the tunings of all the scales for this mapping already
+        sharedKBM = Tunings::startScaleOnAndTuneNoteTo(69, 69, 440.0);
+        quantizerSettings.scale = &scaleStore->getPreset(0);
+        xenosSynth.initVoices(NUM_VOICES, &xenosSynth.noteCounter, &srProvider, &sharedquantizer,
+                              &quantizerSettings, &walkParams);
+        // enough room for the steps of any preset, only larger custom scales need more
+        for (int i = 0; i < SCALE_PRESETS; ++i)
+            reservedQuantizerSteps = std::max(reservedQuantizerSteps,
+                                              Quantizer::getMaxSteps(scaleStore->getPreset(i)));
+        for (int i = 0; i < xenosSynth.getNumVoices(); ++i)
+            xenosSynth.getVoice(i)->xenos.quantizer.reserveSteps(reservedQuantizerSteps);
+        setVoiceSleepLevel(voiceSleepLevel);
+        keyboardState.addListener(this);
+        hostNotes.reset(1024);
+        startTimerHz(20);
+    }
+    ~XenosSynthHolder() override
+    {
+        keyboardState.removeListener(this);
+        stopTimer();
+    }
+
+    // The parameters are polled once per block on the audio thread, so they take effect
+    // whether or not an editor is open
+    void attachParameters(const XenosParamValues &values)
+    {
+        paramValues = values;
+        sharedquantizer.attachScaleParameter(values[(size_t)XenosParam::scale]);
+        for (auto &v : appliedParams)
+            v = std::numeric_limits<float>::quiet_NaN();
+    }
+
+    struct MemoryReport
+    {
+        int numVoices = 0;
+        size_t voiceBytes = 0;
+        size_t engineBytes = 0;
+        // the scale store and the tuning cache are shared by all instances in the process, so
+        // they're reported separately
+        size_t sharedBytes = 0;
+        juce::String toString() const
+        {
+            juce::String result;
+            result << "Instance memory: " << juce::File::descriptionOfSizeInBytes(engineBytes)
+                   << "\n"
+                   << numVoices << " voices: " << juce::File::descriptionOfSizeInBytes(voiceBytes)
+                   << "\n"
+                   << "Shared scales and tunings: "
+                   << juce::File::descriptionOfSizeInBytes(sharedBytes);
+            return result;
+        }
+    };
+    MemoryReport getMemoryReport()
+    {
+        MemoryReport report;
+        report.numVoices = xenosSynth.getNumVoices();
+        for (int i = 0; i < xenosSynth.getNumVoices(); ++i)
+            report.voiceBytes += xenosSynth.getVoice(i)->getMemoryUsage();
+        report.engineBytes = sizeof(*this) + customScale.getMemoryUsage() + report.voiceBytes;
+        report.sharedBytes =
+            scaleStore->getMemoryUsage() + sharedquantizer.tuningCache->getMemoryUsage();
+        return report;
+    }
+
+    std::unique_ptr<VoiceRenderPool> setRenderPool(std::unique_ptr<VoiceRenderPool> pool)
+    {
+        return xenosSynth.setRenderPool(std::move(pool));
+    }
+
+    void prepareToPlay(int samplesPerBlockExpected, double sampleRate)
+    {
+        currentSampleRate = sampleRate;
+        srProvider.samplerate = sampleRate;
+        srProvider.initTables();
+        xenosSynth.setCurrentPlaybackSampleRate(sampleRate);
+        xenosSynth.prepareGovernor(sampleRate, samplesPerBlockExpected);
+    }
+
+    // Voices for growing the synth's pool, ready to play except for the parameters, which the
+    // caller sets with setVoiceParam before handing them to XenosSynth::addVoices
+    std::vector<std::unique_ptr<XenosVoice>> createVoices(int numVoices)
+    {
+        auto result = XenosSynth::createVoices(numVoices, &xenosSynth.noteCounter, &srProvider,
+                                               &sharedquantizer, &quantizerSettings,
+                                               &walkParams);
+        for (auto &v : result)
+        {
+            v->xenos.quantizer.reserveSteps(reservedQuantizerSteps);
+            v->setCurrentPlaybackSampleRate(currentSampleRate);
+            v->setSleepThreshold(juce::Decibels::decibelsToGain(voiceSleepLevel, sleepOffLevel));
+        }
+        return result;
+    }
+
+    // Voices quieter than this for a while go to sleep, see XenosVoice::setSleepThreshold.
+    // sleepOffLevel and below turn voice sleep off.
+    void setVoiceSleepLevel(float decibels)
+    {
+        voiceSleepLevel = juce::jmax(decibels, sleepOffLevel);
+        const float gain = juce::Decibels::decibelsToGain(voiceSleepLevel, sleepOffLevel);
+        for (int i = 0; i < xenosSynth.getNumVoices(); ++i)
+            xenosSynth.getVoice(i)->setSleepThreshold(gain);
+    }
+    float getVoiceSleepLevel() const { return voiceSleepLevel; }
+    static constexpr float sleepOffLevel = -144.0f;
+
+    // Returns false if the synth was idle and the buffer was left silent
+    bool processBlock(juce::AudioBuffer<float> &buffer, juce::MidiBuffer &midiMessages)
+    {
+        XENOS_TRACE_SCOPE("XenosSynthHolder::processBlock");
+        buffer.clear();
+        // a custom scale and its table, published together, are picked up in the same block
+        applyPendingScale();
+        sharedquantizer.applyPendingTuning();
+        sharedquantizer.updateExternalTuning();
+        // The keyboard state isn't touched here, the host notes it shows go to the message
+        // thread
+        for (const auto metadata : midiMessages)
+            pushHostNote(metadata.data, metadata.numBytes);
+
+        // JUCE doesn't timestamp parameter changes, the ones since the last block take effect at
+        // its start
+        blockEvents.clear();
+        for (int i = 0; i < (int)XenosParam::numParams; ++i)
+        {
+            if (paramValues[i] == nullptr)
+                continue;
+            const float value = paramValues[i]->load(std::memory_order_relaxed);
+            if (value == appliedParams[i])
+                continue;
+            appliedParams[i] = value;
+            blockEvents.addParameter(0, i, value);
+        }
+        for (const auto metadata : midiMessages)
+            blockEvents.addMidi(metadata.samplePosition, metadata.data, metadata.numBytes);
+
+        // With no MIDI and nothing sounding the parameter changes, all at the block start, are
+        // applied directly. Unless one of them woke a parked voice the block stays silent.
+        if (midiMessages.isEmpty() && xenosSynth.isIdle())
+        {
+            for (int i = 0; i < blockEvents.size(); ++i)
+                setParam((XenosParam)blockEvents[i].paramIndex, blockEvents[i].value);
+            blockEvents.clear();
+            if (xenosSynth.isIdle())
             {
-                xenos.quantizer.setRoot(newValue);
+                xenosSynth.publishTelemetry();
+                return false;
             }
         }
+
+        xenosSynth.beginBlock();
+        blockEvents.process(
+            buffer.getNumSamples(),
+            [&](int startSample, int numSamples) {
+                xenosSynth.renderNextBlock(buffer, startSample, numSamples);
+            },
+            [this](const EngineEvent &ev) {
+                if (ev.type == EngineEvent::Type::Midi)
+                    xenosSynth.handleMidiEvent(ev.getMidiMessage());
+                else
+                    setParam((XenosParam)ev.paramIndex, ev.value);
+            });
+        xenosSynth.publishTelemetry();
+        xenosSynth.publishBreakpoints(buffer.getNumSamples());
+        xenosSynth.publishCycles(buffer.getNumSamples());
+        return true;
+    }
+
+    // Audio thread. Every scale's tuning is compiled already, so selecting one only switches
+    // pointers. 0 turns the quantizer off.
+    void selectScale(float newValue)
+    {
+        const int index = juce::jlimit(0, (int)SCALE_PRESETS, (int)newValue - 1);
+        const bool active = newValue >= 1.0f;
+        customScaleSelected = active && index == SCALE_PRESETS;
+        if (customScaleSelected)
+            quantizerSettings.scale = &customScaleStates.getCurrent().scale;
+        else if (active)
+            quantizerSettings.scale = &scaleStore->getPreset(index);
+        if (active)
+            sharedquantizer.selectScale(index);
+        quantizerSettings.active = active;
+        sharedquantizer.active = active;
+        ++quantizerSettings.version;
     }
 
-    bool loadScala(juce::File fn)
+    // Notes played on the on-screen keyboard go to the synth through its lock-free FIFO
+    void handleNoteOn(juce::MidiKeyboardState *, int midiChannel, int midiNoteNumber,
+                      float velocity) override
+    {
+        if (!processingHostMidi)
+            xenosSynth.pushKeyboardEvent(
+                juce::MidiMessage::noteOn(midiChannel, midiNoteNumber, velocity));
+    }
+    void handleNoteOff(juce::MidiKeyboardState *, int midiChannel, int midiNoteNumber,
+                       float velocity) override
     {
-        auto err = sharedquantizer.loadScalaFile(fn, sharedKBM);
-        return err.isEmpty();
+        if (!processingHostMidi)
+            xenosSynth.pushKeyboardEvent(
+                juce::MidiMessage::noteOff(midiChannel, midiNoteNumber, velocity));
     }
-    bool loadScl(juce::StringArray &s, bool load)
+
+    void setParam(const juce::String &parameterID, float newValue)
     {
-        bool result = false;
-        if (!s.isEmpty())
+        const int index = findXenosParam(parameterID);
+        if (index >= 0)
+            setParam((XenosParam)index, newValue);
+    }
+
+    // Meant for the audio thread, which gets there through processBlock
+    void setParam(XenosParam param, float newValue)
+    {
+        // the quantizer settings are shared by the voices, they pick up the change lazily
+        switch (param)
         {
+        case XenosParam::scale:
+            selectScale(newValue);
+            return;
+        case XenosParam::root:
+            quantizerSettings.root = (newValue > 11.9999999) ? 0.0 : newValue;
+            ++quantizerSettings.version;
+            return;
+        case XenosParam::mainhpfilterfrequency:
+            // the processor's output filter
+            return;
+        case XenosParam::pitchBarrier:
+            walkParams.pitchWalk.setBarrierRatio(newValue);
+            return;
+        case XenosParam::pitchStep:
+            walkParams.pitchWalk.setStepRatio(newValue);
+            return;
+        case XenosParam::ampGain:
+            walkParams.ampWalk.setSecBarriers(juce::Decibels::decibelsToGain(newValue, -96.0f));
             for (int i = 0; i < xenosSynth.getNumVoices(); ++i)
-            {
-                auto voice = dynamic_cast<XenosVoice *>(xenosSynth.getVoice(i));
-                XenosCore &xenos = voice->xenos;
-                xenos.quantizer.loadScl(s, load);
-            }
-            result = true;
+                xenosSynth.getVoice(i)->wakeUp();
+            return;
+        case XenosParam::ampBarrier:
+            walkParams.ampWalk.setBarrierRatio(newValue);
+            return;
+        case XenosParam::ampStep:
+            walkParams.ampWalk.setStepRatio(newValue);
+            return;
+        case XenosParam::pitchDistribution:
+            walkParams.pitchSource.mode = (int)newValue;
+            return;
+        case XenosParam::pitchWalk:
+            walkParams.pitchWalk.setWalk(newValue);
+            return;
+        case XenosParam::pitchAlpha:
+            walkParams.pitchSource.alpha = newValue;
+            return;
+        case XenosParam::pitchBeta:
+            walkParams.pitchSource.beta = newValue;
+            return;
+        case XenosParam::ampDistribution:
+            walkParams.ampSource.mode = (int)newValue;
+            return;
+        case XenosParam::ampWalk:
+            walkParams.ampWalk.setWalk(newValue);
+            return;
+        case XenosParam::ampAlpha:
+            walkParams.ampSource.alpha = newValue;
+            return;
+        case XenosParam::ampBeta:
+            walkParams.ampSource.beta = newValue;
+            return;
+        default:
+            break;
         }
-        return result;
+        for (int i = 0; i < xenosSynth.getNumVoices(); ++i)
+            setVoiceParam(*xenosSynth.getVoice(i), param, newValue);
+    }
+
+    // the parameters kept per voice, the others are in walkParams
+    void setVoiceParam(XenosVoice &voice, XenosParam param, float newValue)
+    {
+        XenosCore &xenos = voice.xenos;
+        switch (param)
+        {
+        case XenosParam::voicePanningMode:
+            voice.vpm = (VoicePanMode)(int)newValue;
+            break;
+        case XenosParam::segments:
+            xenos.nPoints_ = newValue;
+            break;
+        case XenosParam::pitchWidth:
+            xenos.pitchWidthKeys = newValue;
+            if (voice.isVoiceActive())
+                xenos.calcMetaParams();
+            break;
+        case XenosParam::attack:
+            voice.a = newValue;
+            voice.updateADSR();
+            break;
+        case XenosParam::decay:
+            voice.d = newValue;
+            voice.updateADSR();
+            break;
+        case XenosParam::sustain:
+            voice.s = juce::Decibels::decibelsToGain(newValue, -96.0f);
+            voice.updateADSR();
+            voice.wakeUp();
+            break;
+        case XenosParam::release:
+            voice.r = newValue;
+            voice.updateADSR();
+            break;
+        default:
+            break;
+        }
+    }
+
+    bool loadScala(juce::File fn) { return loadScalaText(fn.loadFileAsString()); }
+    // Parses the Scala text once and hands the result to both quantizer implementations
+    bool loadScalaText(const juce::String &text)
+    {
+        if (text.isEmpty())
+            return false;
+        auto str = text.toStdString();
+        scala::SclData data;
+        if (!scala::parseScl(str, data).empty())
+            return false;
+        return loadScalaData(data, str);
+    }
+    // For scales that were parsed before, like the ones in saved sessions
+    // Message thread. The voices never see customScale itself, only the copy handed over with
+    // its tuning, which replaces the custom scale in the next block. Selecting it is up to the
+    // scale parameter.
+    bool loadScalaData(const scala::SclData &data, const std::string &text)
+    {
+        if (sharedquantizer.setCustomScale(data, text).isNotEmpty())
+            return false;
+        customScale = Scale(data);
+        customScl = data;
+        hasCustomScl = true;
+        auto state = std::make_unique<CustomScaleState>();
+        state->scale = customScale;
+        // the voices' quantizers get the room for a larger scale along with it
+        const size_t maxSteps = Quantizer::getMaxSteps(state->scale);
+        if (maxSteps > reservedQuantizerSteps)
+        {
+            reservedQuantizerSteps = maxSteps;
+            state->stepBuffers.resize((size_t)xenosSynth.getNumVoices());
+            for (auto &b : state->stepBuffers)
+                b.reserve(maxSteps);
+        }
+        customScaleStates.publish(std::move(state));
+        return true;
+    }
+    void resetKbm()
+    {
+        sharedKBM = Tunings::startScaleOnAndTuneNoteTo(69, 69, 440.0);
+        sharedquantizer.setKeyboardMapping(sharedKBM);
+        hasCustomKbm = false;
+    }
+    bool loadKbm(juce::File fn) { return loadKbmText(fn.loadFileAsString()); }
+    bool loadKbmText(const juce::String &text)
+    {
+        auto str = text.toStdString();
+        scala::KbmData data;
+        if (!scala::parseKbm(str, data).empty())
+            return false;
+        return loadKbmData(data, str);
+    }
+    bool loadKbmData(const scala::KbmData &data, const std::string &text)
+    {
+        auto kbm = keyboardMappingFromKbm(data, text);
+        if (sharedquantizer.setKeyboardMapping(kbm).isNotEmpty())
+            return false;
+        sharedKBM = kbm;
+        customKbm = data;
+        hasCustomKbm = true;
+        return true;
     }
+    // the parsed custom scale and mapping, for saving them with the session
+    const scala::SclData *getCustomScl() const { return hasCustomScl ? &customScl : nullptr; }
+    const scala::KbmData *getCustomKbm() const { return hasCustomKbm ? &customKbm : nullptr; }
     XenosSynth xenosSynth;
 
   private:
     juce::MidiKeyboardState &keyboardState;
+    double currentSampleRate = 0.0;
+    scala::SclData customScl;
+    scala::KbmData customKbm;
+    bool hasCustomScl = false;
+    bool hasCustomKbm = false;
+    float voiceSleepLevel = -96.0f;
+    XenosParamValues paramValues{};
+    // what the audio thread last saw of each parameter, NaN until the first block
+    float appliedParams[(int)XenosParam::numParams] = {};
+    // audio thread only
+    bool customScaleSelected = false;
+    // the room for steps every voice's quantizer has or gets with the next scale state,
+    // message thread only
+    size_t reservedQuantizerSteps = 0;
+    EngineEventList blockEvents;
+
+    // The custom scale as the audio thread sees it, built on the message thread and never
+    // changed once it's handed over, so loading another one can't change a scale the voices
+    // are reading. The presets are shared and never change.
+    struct CustomScaleState
+    {
+        Scale scale;
+        // Step buffers for the voices in the pool when it was published, if the scale needs
+        // more room than they have. The audio thread swaps them with the voices' own, so these
+        // hold the old ones by the time the state is retired.
+        mutable std::vector<std::vector<double>> stepBuffers;
+    };
+    AudioHandover<CustomScaleState> customScaleStates{std::make_unique<CustomScaleState>()};
+
+    // Audio thread, at the start of every block. The version is only ever changed on the audio
+    // thread.
+    void applyPendingScale()
+    {
+        if (auto *state = customScaleStates.acquire())
+        {
+            const int numBuffers =
+                juce::jmin((int)state->stepBuffers.size(), xenosSynth.getNumVoices());
+            for (int i = 0; i < numBuffers; ++i)
+                xenosSynth.getVoice(i)->xenos.quantizer.swapStepBuffer(state->stepBuffers[i]);
+            if (customScaleSelected)
+            {
+                quantizerSettings.scale = &state->scale;
+                ++quantizerSettings.version;
+            }
+        }
+    }
+
+    // Releases what the audio thread handed back when nothing new is published for a while,
+    // shows the host notes and moves the keyboard backlog on
+    void timerCallback() override
+    {
+        showHostNotes();
+        xenosSynth.flushKeyboardBacklog();
+        customScaleStates.collectRetired();
+        sharedquantizer.releaseRetiredTunings();
+    }
+
+    // The host's note-ons and note-offs, from the audio thread to the message thread, which
+    // shows them on the keyboard. Display only, so when the FIFO overflows the host's notes are
+    // taken off the keyboard rather than left showing notes that may have ended.
+    struct HostNote
+    {
+        uint8_t bytes[3] = {0, 0, 0};
+    };
+    choc::fifo::SingleReaderSingleWriterFIFO<HostNote> hostNotes;
+    std::atomic<bool> hostNotesOverflowed{false};
+    // the host notes on the keyboard, by channel 1-16 and key, message thread only
+    std::bitset<17 * 128> hostNotesShown;
+
+    // audio thread
+    void pushHostNote(const juce::uint8 *data, int numBytes)
+    {
+        if (numBytes < 3)
+            return;
+        const int type = data[0] & 0xf0;
+        const bool allNotesOff = type == 0xb0 && (data[1] == 120 || data[1] == 123);
+        if (type != 0x80 && type != 0x90 && !allNotesOff)
+            return;
+        HostNote note;
+        for (int i = 0; i < 3; ++i)
+            note.bytes[i] = data[i];
+        if (!hostNotes.push(note))
+            hostNotesOverflowed.store(true, std::memory_order_relaxed);
+    }
+
+    // message thread
+    void showHostNotes()
+    {
+        // the listener callbacks the host notes cause are recognised by the flag and not fed
+        // back to the synth
+        processingHostMidi = true;
+        HostNote note;
+        while (hostNotes.pop(note))
+        {
+            const juce::MidiMessage message(note.bytes, 3);
+            const int channel = message.getChannel();
+            if (message.isNoteOnOrOff())
+                hostNotesShown[(size_t)(channel * 128 + message.getNoteNumber())] =
+                    message.isNoteOn();
+            else
+                for (int key = 0; key < 128; ++key)
+                    hostNotesShown[(size_t)(channel * 128 + key)] = false;
+            keyboardState.processNextMidiEvent(message);
+        }
+        if (hostNotesOverflowed.exchange(false, std::memory_order_relaxed))
+        {
+            for (size_t i = 0; i < hostNotesShown.size(); ++i)
+                if (hostNotesShown[i])
+                    keyboardState.noteOff((int)(i / 128), (int)(i % 128), 0.0f);
+            hostNotesShown.reset();
+        }
+        processingHostMidi = false;
+    }
+
+    // thread local, so it's only ever seen set on the thread showing the host notes
+    static inline thread_local bool processingHostMidi = false;
 };
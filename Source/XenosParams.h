@@ -0,0 +1,88 @@
+/*
+  ==============================================================================
+
+    XenosParams.h
+
+    Xenos: Xenharmonic Stochastic Synthesizer
+    Raphael Radna
+    This code is licensed under the GPLv3
+
+  ==============================================================================
+*/
+
+#pragma once
+
+#include <JuceHeader.h>
+
+// The plugin parameters, indexed the same way in parameter events
+enum class XenosParam
+{
+    segments,
+    pitchWidth,
+    pitchBarrier,
+    pitchStep,
+    ampGain,
+    ampBarrier,
+    ampStep,
+    pitchDistribution,
+    pitchWalk,
+    pitchAlpha,
+    pitchBeta,
+    ampDistribution,
+    ampWalk,
+    ampAlpha,
+    ampBeta,
+    attack,
+    decay,
+    sustain,
+    release,
+    scale,
+    root,
+    mainhpfilterfrequency,
+    voicePanningMode,
+    numParams
+};
+
+// the processor's raw parameter values, indexed by XenosParam
+using XenosParamValues = std::array<std::atomic<float> *, (size_t)XenosParam::numParams>;
+
+// The parameter IDs, as juce::Strings made once so that looking them up doesn't allocate
+inline const juce::StringArray &getXenosParamIDs()
+{
+    static const juce::StringArray ids{"segments",
+                                       "pitchWidth",
+                                       "pitchBarrier",
+                                       "pitchStep",
+                                       "ampGain",
+                                       "ampBarrier",
+                                       "ampStep",
+                                       "pitchDistribution",
+                                       "pitchWalk",
+                                       "pitchAlpha",
+                                       "pitchBeta",
+                                       "ampDistribution",
+                                       "ampWalk",
+                                       "ampAlpha",
+                                       "ampBeta",
+                                       "attack",
+                                       "decay",
+                                       "sustain",
+                                       "release",
+                                       "scale",
+                                       "root",
+                                       "mainhpfilterfrequency",
+                                       "voicePanningMode"};
+    jassert(ids.size() == (int)XenosParam::numParams);
+    return ids;
+}
+
+inline const juce::String &getXenosParamID(XenosParam param)
+{
+    return getXenosParamIDs().getReference((int)param);
+}
+
+// -1 for IDs that aren't Xenos parameters
+inline int findXenosParam(const juce::String &parameterID)
+{
+    return getXenosParamIDs().indexOf(parameterID);
+}
@@ -1,5 +1,8 @@
 #include <complex>
-// #include "Xenos.h"
+#include "Xenos.h"
+#include "OutputStage.h"
+#include "RealtimeGuard.h"
+#include "StateChunk.h"
 #include <JuceHeader.h>
 #include "Tunings.h"
 #include <random>
@@ -158,6 +161,150 @@ inline void test_vintage_grains()
               << millisecondsToPercentage(44100, procbufsize, avg) << "%\n";
 }
 
+// Stand-in for an MTS-ESP master that keeps sweeping its tuning. Each block a number of notes get
+// detuned by a new amount, like when the master's tuning is being modulated.
+struct SweepingTuningSource : public ExternalTuningSource
+{
+    bool isActive() override { return true; }
+    double getFrequencyForMidiNote(int note) override
+    {
+        return 440.0 * std::pow(2.0, (note - 69 + detune[note]) / 12.0);
+    }
+    void advance(int notesToRetune)
+    {
+        for (int i = 0; i < notesToRetune; ++i)
+        {
+            int note = (nextNote + i) % 128;
+            detune[note] = 0.5 * std::sin(phase + note * 0.1);
+        }
+        nextNote = (nextNote + notesToRetune) % 128;
+        phase += 0.01;
+    }
+    double detune[128] = {};
+    double phase = 0.0;
+    int nextNote = 0;
+};
+
+inline void test_mts_retuning_storm()
+{
+    double sr = 44100.0;
+    int procbufsize = 512;
+    int numblocks = 10 * sr / procbufsize;
+    for (int notesPerBlock : {0, 1, 12, 128})
+    {
+        juce::MidiKeyboardState keyState;
+        XenosSynthHolder holder(keyState);
+        SweepingTuningSource source;
+        holder.sharedquantizer.externalSource = &source;
+        holder.prepareToPlay(procbufsize, sr);
+        holder.setParam("scale", 1.0f);
+        juce::AudioBuffer<float> buf(2, procbufsize);
+        juce::MidiBuffer midi;
+        for (int i = 0; i < 32; ++i)
+            midi.addEvent(juce::MidiMessage::noteOn(1, 36 + i * 2, 1.0f), 0);
+        std::vector<double> benchmarks;
+        benchmarks.reserve(numblocks);
+        for (int i = 0; i < numblocks; ++i)
+        {
+            source.advance(notesPerBlock);
+            double t0 = juce::Time::getMillisecondCounterHiRes();
+            holder.processBlock(buf, midi);
+            double t1 = juce::Time::getMillisecondCounterHiRes();
+            benchmarks.push_back(t1 - t0);
+            midi.clear();
+        }
+        double median = calcMedian(benchmarks);
+        auto avg = std::accumulate(benchmarks.begin(), benchmarks.end(), 0.0) / benchmarks.size();
+        std::cout << notesPerBlock << " notes retuned per block, 32 voices: median "
+                  << millisecondsToPercentage(sr, procbufsize, median) << "%, average "
+                  << millisecondsToPercentage(sr, procbufsize, avg) << "%\n";
+    }
+}
+
+// The fused output stage against the separate passes it replaced, a juce::dsp highpass and a
+// gain multiply, on noise with a DC offset
+inline void test_output_stage()
+{
+    double sr = 44100.0;
+    int procbufsize = 512;
+    int numblocks = 60 * sr / procbufsize;
+    juce::AudioBuffer<float> bufA(2, procbufsize), bufB(2, procbufsize);
+    juce::dsp::StateVariableTPTFilter<float> filter;
+    filter.prepare({sr, (juce::uint32)procbufsize, 2});
+    filter.setType(juce::dsp::StateVariableTPTFilterType::highpass);
+    filter.setCutoffFrequency(16.0f);
+    filter.setResonance(1.0 / std::sqrt(2.0f));
+    // not 1, which applyGain skips
+    const float gain = juce::Decibels::decibelsToGain(-6.0f);
+    OutputStage stage;
+    // before prepare, so the stage starts at the gain rather than ramping to it
+    stage.setGain(gain);
+    stage.prepare(sr);
+    juce::Random rng;
+    std::vector<double> separate, fused;
+    separate.reserve(numblocks);
+    fused.reserve(numblocks);
+    float maxDiff = 0.0f;
+    for (int i = 0; i < numblocks; ++i)
+    {
+        for (int ch = 0; ch < 2; ++ch)
+            for (int j = 0; j < procbufsize; ++j)
+                bufA.setSample(ch, j, rng.nextFloat() - 0.3f);
+        bufB.makeCopyOf(bufA);
+        double t0 = juce::Time::getMillisecondCounterHiRes();
+        juce::dsp::AudioBlock<float> block(bufA);
+        filter.process(juce::dsp::ProcessContextReplacing<float>(block));
+        bufA.applyGain(gain);
+        double t1 = juce::Time::getMillisecondCounterHiRes();
+        stage.process(bufB.getArrayOfWritePointers(), 2, procbufsize);
+        double t2 = juce::Time::getMillisecondCounterHiRes();
+        separate.push_back(t1 - t0);
+        fused.push_back(t2 - t1);
+        for (int ch = 0; ch < 2; ++ch)
+            for (int j = 0; j < procbufsize; ++j)
+                maxDiff =
+                    std::max(maxDiff, std::abs(bufA.getSample(ch, j) - bufB.getSample(ch, j)));
+    }
+    std::cout << "separate passes: median "
+              << millisecondsToPercentage(sr, procbufsize, calcMedian(separate)) << "%\n";
+    std::cout << "fused output stage: median "
+              << millisecondsToPercentage(sr, procbufsize, calcMedian(fused)) << "%\n";
+    std::cout << "largest difference " << maxDiff << "\n";
+}
+
+// Plays both engines inside a real-time context, in a build with XENOS_RT_GUARD every
+// allocation or lock on the way is reported. Returns the number of violations.
+inline int test_realtime_guard()
+{
+    double sr = 44100.0;
+    int procbufsize = 512;
+    int numblocks = 5 * sr / procbufsize;
+    juce::MidiKeyboardState keyState;
+    XenosSynthHolder holder(keyState);
+    holder.prepareToPlay(procbufsize, sr);
+    holder.setParam("scale", 1.0f);
+    auto grains = std::make_unique<XenVintageGranular>(1);
+    grains->setSampleRate(sr);
+    juce::AudioBuffer<float> buf(2, procbufsize);
+    juce::MidiBuffer midi;
+    rt_guard::resetViolations();
+    for (int i = 0; i < numblocks; ++i)
+    {
+        midi.clear();
+        if (i % 20 == 0)
+            for (int j = 0; j < 16; ++j)
+                midi.addEvent(juce::MidiMessage::noteOn(1, 36 + (i + j * 5) % 60, 1.0f), j);
+        if (i % 20 == 10)
+            midi.addEvent(juce::MidiMessage::allNotesOff(1), 0);
+        rt_guard::ScopedRealtimeContext realtimeContext;
+        holder.processBlock(buf, midi);
+        grains->processBlock(buf.getWritePointer(0), buf.getWritePointer(1), procbufsize);
+    }
+    const int violations = rt_guard::getNumViolations();
+    std::cout << violations << " real-time violations\n";
+    return violations;
+}
+
 void test_jsonparse()
 {
     juce::File datafile(R"(C:\develop\xenos\VintageGranular\testscreens.json)");
@@ -318,6 +465,205 @@ inline void runVintageGranularTests()
     vgBasicTests(progress);
 }
 
+inline void xenosVoiceTests(choc::test::TestProgress &progress)
+{
+    {
+        CHOC_TEST(A note-off frees a parked voice);
+        double sr = 44100.0;
+        int procbufsize = 512;
+        juce::MidiKeyboardState keyState;
+        XenosSynthHolder holder(keyState);
+        holder.prepareToPlay(procbufsize, sr);
+        // every level counts as silent, so the voice parks soon after reaching the sustain
+        holder.setVoiceSleepLevel(0.0f);
+        auto &synth = holder.xenosSynth;
+        juce::AudioBuffer<float> buf(2, procbufsize);
+        juce::MidiBuffer midi;
+        midi.addEvent(juce::MidiMessage::noteOn(1, 60, 1.0f), 0);
+        for (int i = 0; i < sr / procbufsize; ++i)
+        {
+            holder.processBlock(buf, midi);
+            midi.clear();
+        }
+        CHOC_EXPECT_EQ(synth.getNumActiveVoices(), 1);
+        CHOC_EXPECT_TRUE(synth.getVoice(0)->isParked());
+        midi.addEvent(juce::MidiMessage::noteOff(1, 60, 0.0f), 0);
+        holder.processBlock(buf, midi);
+        CHOC_EXPECT_EQ(synth.getNumActiveVoices(), 0);
+        CHOC_EXPECT_FALSE(synth.getVoice(0)->isVoiceActive());
+    }
+}
+
+inline void scalaParserTests(choc::test::TestProgress &progress)
+{
+    {
+        CHOC_TEST(Ratios and bare integers);
+        scala::SclData scl;
+        CHOC_EXPECT_EQ(scala::parseScl("Pythagorean\n 3\n 9/8\n 3/2\n 2\n", scl), "");
+        CHOC_EXPECT_EQ(scl.description, "Pythagorean");
+        CHOC_EXPECT_EQ((int)scl.tones.size(), 3);
+        CHOC_EXPECT_TRUE(scl.tones[1].type == scala::Tone::Ratio);
+        CHOC_EXPECT_EQ(scl.tones[1].numerator, 3LL);
+        CHOC_EXPECT_EQ(scl.tones[1].denominator, 2LL);
+        CHOC_EXPECT_TRUE(std::abs(scl.tones[1].cents - 701.955) < 0.001);
+        // a bare integer is a ratio over 1
+        CHOC_EXPECT_EQ(scl.tones[2].numerator, 2LL);
+        CHOC_EXPECT_EQ(scl.tones[2].denominator, 1LL);
+        CHOC_EXPECT_TRUE(std::abs(scl.getPeriodCents() - 1200.0) < 1.0e-9);
+    }
+    {
+        CHOC_TEST(Cents);
+        scala::SclData scl;
+        CHOC_EXPECT_EQ(scala::parseScl("5 EDO\n5\n240.0\n480.\n720.5\n-0.5\n1200.0\n", scl),
+                       "");
+        CHOC_EXPECT_EQ((int)scl.tones.size(), 5);
+        CHOC_EXPECT_TRUE(scl.tones[0].type == scala::Tone::Cents);
+        CHOC_EXPECT_TRUE(std::abs(scl.tones[1].cents - 480.0) < 1.0e-9);
+        CHOC_EXPECT_TRUE(std::abs(scl.tones[2].cents - 720.5) < 1.0e-9);
+        CHOC_EXPECT_TRUE(std::abs(scl.tones[3].cents + 0.5) < 1.0e-9);
+        CHOC_EXPECT_TRUE(std::abs(scl.tones[4].getRatio() - 2.0) < 1.0e-9);
+    }
+    {
+        CHOC_TEST(Comments blank lines and trailing text);
+        scala::SclData scl;
+        const std::string text = "! just.scl\r\n!\r\nJust fifth\r\n\r\n 2\r\n! the fifth\r\n"
+                                 " 3/2 fifth\r\n\r\n 2/1 octave\r\n";
+        CHOC_EXPECT_EQ(scala::parseScl(text, scl), "");
+        CHOC_EXPECT_EQ(scl.description, "Just fifth");
+        CHOC_EXPECT_EQ((int)scl.tones.size(), 2);
+        CHOC_EXPECT_EQ(scl.tones[0].text, "3/2");
+        CHOC_EXPECT_EQ(scl.tones[1].numerator, 2LL);
+    }
+    {
+        CHOC_TEST(Malformed lines);
+        scala::SclData scl;
+        CHOC_EXPECT_FALSE(scala::parseScl("", scl).empty());
+        CHOC_EXPECT_FALSE(scala::parseScl("no count\n", scl).empty());
+        CHOC_EXPECT_FALSE(scala::parseScl("zero\n0\n", scl).empty());
+        CHOC_EXPECT_FALSE(scala::parseScl("bad count\nthree\n", scl).empty());
+        CHOC_EXPECT_FALSE(scala::parseScl("short\n3\n9/8\n3/2\n", scl).empty());
+        CHOC_EXPECT_FALSE(scala::parseScl("word\n1\nfifth\n", scl).empty());
+        CHOC_EXPECT_FALSE(scala::parseScl("no denominator\n1\n3/\n", scl).empty());
+        CHOC_EXPECT_FALSE(scala::parseScl("negative\n1\n-3/2\n", scl).empty());
+        CHOC_EXPECT_FALSE(scala::parseScl("zero ratio\n1\n0/1\n", scl).empty());
+        CHOC_EXPECT_FALSE(scala::parseScl("bad cents\n1\n.\n", scl).empty());
+    }
+    {
+        CHOC_TEST(Keyboard mappings);
+        scala::KbmData kbm;
+        const std::string text = "! 7 of 12\n7\n0\n127\n60\n69\n440.0\n12\n"
+                                 "0\nx\n2\n! skipped\n4\n5\n";
+        CHOC_EXPECT_EQ(scala::parseKbm(text, kbm), "");
+        CHOC_EXPECT_EQ(kbm.size, 7);
+        CHOC_EXPECT_EQ(kbm.octaveDegree, 12);
+        CHOC_EXPECT_TRUE(std::abs(kbm.referenceFrequency - 440.0) < 1.0e-9);
+        CHOC_EXPECT_EQ((int)kbm.keys.size(), 7);
+        CHOC_EXPECT_EQ(kbm.keys[0], 0);
+        CHOC_EXPECT_EQ(kbm.keys[1], -1);
+        CHOC_EXPECT_EQ(kbm.keys[4], 5);
+        // left out at the end, so unmapped
+        CHOC_EXPECT_EQ(kbm.keys[6], -1);
+        CHOC_EXPECT_FALSE(scala::parseKbm("7\n0\n127\n", kbm).empty());
+        CHOC_EXPECT_FALSE(scala::parseKbm("1\n0\n127\n60\n69\n-440\n12\n0\n", kbm).empty());
+        CHOC_EXPECT_FALSE(scala::parseKbm("1\n0\n127\n60\n69\n440\n12\nkey\n", kbm).empty());
+    }
+}
+
+inline void stateChunkTests(choc::test::TestProgress &progress)
+{
+    {
+        CHOC_TEST(Binary chunk round trip);
+        StateChunk saved;
+        saved.paramValues = {{"scale", 3.0f}, {"pitchWidth", 24.5f}};
+        saved.renderThreads = 2;
+        saved.polyphony = 12;
+        saved.cpuBudget = 0.5f;
+        saved.voiceSleepLevel = -80.0f;
+        saved.outputGain = -6.0f;
+        saved.outputLimiter = true;
+        saved.customScaleName = "fifths";
+        saved.customScaleText = "fifths\n2\n3/2\n2/1\n";
+        saved.customKbmText = "1\n0\n127\n60\n69\n440.0\n1\n0\n";
+        saved.hasScl = scala::parseScl(saved.customScaleText.toStdString(), saved.scl).empty();
+        saved.hasKbm = scala::parseKbm(saved.customKbmText.toStdString(), saved.kbm).empty();
+        juce::MemoryBlock block;
+        saved.writeTo(block);
+
+        StateChunk restored;
+        CHOC_EXPECT_TRUE(StateChunk::isStateChunk(block.getData(), (int)block.getSize()));
+        CHOC_EXPECT_TRUE(restored.readFrom(block.getData(), (int)block.getSize()));
+        CHOC_EXPECT_EQ((int)restored.paramValues.size(), 2);
+        CHOC_EXPECT_EQ(restored.paramValues[1].id, juce::String("pitchWidth"));
+        CHOC_EXPECT_EQ(restored.paramValues[1].value, 24.5f);
+        CHOC_EXPECT_EQ(restored.renderThreads, 2);
+        CHOC_EXPECT_EQ(restored.polyphony, 12);
+        CHOC_EXPECT_EQ(restored.voiceSleepLevel, -80.0f);
+        CHOC_EXPECT_EQ(restored.outputGain, -6.0f);
+        CHOC_EXPECT_TRUE(restored.outputLimiter);
+        CHOC_EXPECT_EQ(restored.customScaleText, saved.customScaleText);
+        CHOC_EXPECT_TRUE(restored.hasScl);
+        CHOC_EXPECT_EQ((int)restored.scl.tones.size(), 2);
+        CHOC_EXPECT_EQ(restored.scl.tones[0].numerator, 3LL);
+        CHOC_EXPECT_TRUE(restored.hasKbm);
+        CHOC_EXPECT_EQ(restored.kbm.referenceNote, 69);
+
+        // truncated, or from another version
+        StateChunk rejected;
+        CHOC_EXPECT_FALSE(rejected.readFrom(block.getData(), (int)block.getSize() - 4));
+        static_cast<char *>(block.getData())[4] = 2;
+        CHOC_EXPECT_FALSE(rejected.readFrom(block.getData(), (int)block.getSize()));
+    }
+    {
+        CHOC_TEST(Legacy XML state);
+        // as older versions wrote it
+        juce::XmlElement xml("parent");
+        auto *xmlParams = xml.createNewChildElement("Xenos");
+        auto *param = xmlParams->createNewChildElement("PARAM");
+        param->setAttribute("id", "scale");
+        param->setAttribute("value", 16.0);
+        auto *xmlScale = xml.createNewChildElement("scaleParams");
+        xmlScale->setAttribute("CUSTOM_SCALE_NAME", "fifths");
+        xmlScale->setAttribute("CUSTOM_SCALE_DATA", "fifths\n2\n3/2\n2/1");
+        xmlScale->setAttribute("CUSTOM_SCALE_DATA2", "fifths\n2\n3/2\n2/1\n");
+        juce::MemoryBlock block;
+        juce::AudioProcessor::copyXmlToBinary(xml, block);
+
+        StateChunk chunk;
+        CHOC_EXPECT_FALSE(StateChunk::isStateChunk(block.getData(), (int)block.getSize()));
+        CHOC_EXPECT_FALSE(chunk.readFrom(block.getData(), (int)block.getSize()));
+        CHOC_EXPECT_TRUE(
+            chunk.readFromLegacyXml(block.getData(), (int)block.getSize(), "Xenos"));
+        CHOC_EXPECT_EQ((int)chunk.paramValues.size(), 1);
+        CHOC_EXPECT_EQ(chunk.paramValues[0].id, juce::String("scale"));
+        CHOC_EXPECT_EQ(chunk.paramValues[0].value, 16.0f);
+        CHOC_EXPECT_EQ(chunk.customScaleName, juce::String("fifths"));
+        CHOC_EXPECT_EQ(chunk.customScaleText, juce::String("fifths\n2\n3/2\n2/1\n"));
+        CHOC_EXPECT_TRUE(chunk.hasScl);
+        CHOC_EXPECT_EQ((int)chunk.scl.tones.size(), 2);
+        CHOC_EXPECT_FALSE(chunk.hasKbm);
+        CHOC_EXPECT_EQ(chunk.outputGain, 0.0f);
+
+        // neither a chunk nor XML
+        const char garbage[] = "not a session";
+        StateChunk rejected;
+        CHOC_EXPECT_FALSE(rejected.readFromLegacyXml(garbage, (int)sizeof(garbage), "Xenos"));
+    }
+}
+
+// Returns true if all tests passed
+inline bool runXenosTests()
+{
+    choc::test::TestProgress progress;
+    CHOC_CATEGORY(Xenos voice tests);
+    xenosVoiceTests(progress);
+    CHOC_CATEGORY(Scala parser);
+    scalaParserTests(progress);
+    CHOC_CATEGORY(Session state);
+    stateChunkTests(progress);
+    progress.printReport();
+    return progress.numFails == 0;
+}
+
 struct myarrtestobject
 {
     // myarrtestobject() {}
@@ -344,9 +690,14 @@ int main()
     // test_dropped_samples();
     // test_xen_grains();
     // test_vintage_grains();
+    // test_mts_retuning_storm();
+    // test_output_stage();
     // test_jsonparse();
     // test_graphing();
     // test_uniform_distances();
     test_array_init();
-    return 0;
+    const bool passed = runXenosTests();
+    // counts nothing unless built with XENOS_RT_GUARD
+    const int violations = test_realtime_guard();
+    return passed && violations == 0 ? 0 : 1;
 }
@@ -51,17 +51,95 @@ void GrainScreenComponent::mouseDown(const juce::MouseEvent &ev)
         return;
     }
     auto &geng = m_proc.m_eng;
-    if (ev.mods.isRightButtonDown() && !geng.isAutoScreenSelectActive())
+    if (ev.mods.isRightButtonDown())
     {
         juce::PopupMenu menu;
-        menu.addItem("Randomize cells", [&geng]() {
-            geng.m_gui_to_audio_fifo.push({GuiToAudioActionType::RandomizeCells,
-                                           geng.getCurrentlyPlayingScreen(), 0, 0, 0.0f});
-        });
-        menu.addItem("Clear cells", [&geng]() {
-            geng.m_gui_to_audio_fifo.push({GuiToAudioActionType::ClearAllCells,
-                                           geng.getCurrentlyPlayingScreen(), 0, 0, 0.0f});
-        });
+        if (!geng.isAutoScreenSelectActive())
+        {
+            menu.addItem("Randomize cells", [&geng]() {
+                geng.m_gui_to_audio_fifo.push({GuiToAudioActionType::RandomizeCells,
+                                               geng.getCurrentlyPlayingScreen(), 0, 0, 0.0f});
+            });
+            menu.addItem("Clear cells", [&geng]() {
+                geng.m_gui_to_audio_fifo.push({GuiToAudioActionType::ClearAllCells,
+                                               geng.getCurrentlyPlayingScreen(), 0, 0, 0.0f});
+            });
+        }
+        menu.addItem("Show CPU heat map", true, m_show_cpu, [this]() { m_show_cpu = !m_show_cpu; });
         menu.showMenuAsync(juce::PopupMenu::Options{});
     }
 }
+
+void GrainScreenComponent::updateCpuHeatMap()
+{
+    auto &stats = m_proc.m_eng.getCpuStats();
+    const bool counting = m_show_cpu && isShowing();
+    stats.setEnabled(counting);
+    if (!counting)
+    {
+        m_cpu_counting = false;
+        return;
+    }
+    // the first snapshot is only the baseline
+    if (!m_cpu_counting)
+    {
+        stats.read(m_cpu_previous);
+        m_cpu_counting = true;
+        return;
+    }
+    stats.read(m_cpu_current);
+    const auto numSamples = m_cpu_current.numSamples - m_cpu_previous.numSamples;
+    for (int i = 0; i < XenVintageGranular::numStreams; ++i)
+    {
+        auto &sc = m_stream_cycles[i];
+        // the cell the stream had in its last counted block, published with the counts
+        sc.screenX = m_cpu_current.tags[i] % 16;
+        sc.screenY = m_cpu_current.tags[i] / 16;
+        for (int j = 0; j < XenGrainStream::NumCycleStages; ++j)
+        {
+            const auto cycles = m_cpu_current.cycles[i][j] - m_cpu_previous.cycles[i][j];
+            sc.perSample[j] = numSamples > 0 ? (float)cycles / numSamples : 0.0f;
+        }
+    }
+    m_cpu_previous = m_cpu_current;
+}
+
+// Tints the cells of the streams by their share of the hottest stream's cycles and writes the
+// cycles per sample into them, the totals of the stages go under the load bar
+void GrainScreenComponent::paintCpuHeatMap(juce::Graphics &g, float cellw, float cellh)
+{
+    std::array<float, XenGrainStream::NumCycleStages> stageTotals{};
+    float hottest = 0.0f;
+    for (auto &sc : m_stream_cycles)
+    {
+        float streamTotal = 0.0f;
+        for (int j = 0; j < XenGrainStream::NumCycleStages; ++j)
+        {
+            stageTotals[j] += sc.perSample[j];
+            streamTotal += sc.perSample[j];
+        }
+        hottest = juce::jmax(hottest, streamTotal);
+    }
+    g.setFont(12.0f);
+    for (auto &sc : m_stream_cycles)
+    {
+        float streamTotal = 0.0f;
+        for (auto c : sc.perSample)
+            streamTotal += c;
+        if (streamTotal <= 0.0f || sc.screenX < 0)
+            continue;
+        const float xcor = cellw * sc.screenX;
+        const float ycor = cellh * sc.screenY;
+        g.setColour(juce::Colours::red.withAlpha(0.6f * streamTotal / hottest));
+        g.fillRect(xcor, ycor, cellw, cellh);
+        g.setColour(juce::Colours::white);
+        g.drawText(juce::String(streamTotal, 0), juce::Rectangle<float>(xcor, ycor, cellw, cellh),
+                   juce::Justification::centredBottom);
+    }
+    g.setColour(juce::Colours::white);
+    g.drawText("cycles/sample: scheduling " +
+                   juce::String(stageTotals[XenGrainStream::SchedulingStage], 0) + ", grains " +
+                   juce::String(stageTotals[XenGrainStream::GrainsStage], 0) + ", distortion " +
+                   juce::String(stageTotals[XenGrainStream::DistortionStage], 0),
+               1, 17, 500, 15, juce::Justification::centredLeft);
+}
@@ -15,8 +15,16 @@ class GrainScreenComponent : public juce::Component, public juce::Timer
     };
 
     GrainScreenComponent(VintageGranularAudioProcessor &p) : m_proc(p) { startTimerHz(10); }
-    ~GrainScreenComponent() override { m_proc.m_eng.setVisualizationEnabled(false); }
-    void timerCallback() override { repaint(); }
+    ~GrainScreenComponent() override
+    {
+        m_proc.m_eng.setVisualizationEnabled(false);
+        m_proc.m_eng.getCpuStats().setEnabled(false);
+    }
+    void timerCallback() override
+    {
+        updateCpuHeatMap();
+        repaint();
+    }
     unsigned int m_foo = 0;
     void paint(juce::Graphics &g) override
     {
@@ -95,6 +103,8 @@ class GrainScreenComponent : public juce::Component, public juce::Timer
                            juce::Justification::centred);
             }
         }
+        if (m_show_cpu)
+            paintCpuHeatMap(g, w, h);
 
         for (int i = 0; i < 17; ++i)
         {
@@ -112,11 +122,32 @@ class GrainScreenComponent : public juce::Component, public juce::Timer
         g.drawRect(1, 1, 500, 15);
         g.setColour(juce::Colours::green.withAlpha(1.0f));
         g.fillRect(1, 1, cpuload, 15);
+        // the average hides the slow blocks, these are what cause dropouts
+        auto timing = m_proc.getBlockTimingReport();
+        g.setColour(juce::Colours::white);
+        g.drawText("p99 " + juce::String(timing.p99, 2) + " ms, max " +
+                       juce::String(timing.max, 2) + " ms, " +
+                       juce::String(timing.deadlineMisses) + " late",
+                   505, 1, 300, 15, juce::Justification::centredLeft);
     }
     void visibilityChanged() override { m_proc.m_eng.setVisualizationEnabled(isVisible()); }
     void mouseDown(const juce::MouseEvent &ev) override;
 
   private:
+    // the cycles per sample of the streams since the last update, counted only while shown
+    void updateCpuHeatMap();
+    void paintCpuHeatMap(juce::Graphics &g, float cellw, float cellh);
+    struct StreamCycles
+    {
+        int screenX = -1;
+        int screenY = -1;
+        std::array<float, XenGrainStream::NumCycleStages> perSample{};
+    };
+    bool m_show_cpu = false;
+    bool m_cpu_counting = false;
+    XenVintageGranular::CpuStats::Snapshot m_cpu_previous, m_cpu_current;
+    std::array<StreamCycles, XenVintageGranular::numStreams> m_stream_cycles;
+
     VintageGranularAudioProcessor &m_proc;
     int m_sel_cell_x = -1;
     int m_sel_cell_y = -1;
@@ -67,6 +67,13 @@ VintageGranularAudioProcessor::VintageGranularAudioProcessor()
       m_apvts(*this, nullptr, "STATE", createParameters())
 {
     FOLEYS_SET_SOURCE_PATH(__FILE__);
+    for (int i = 0; i < ParamIDs::NumParams; ++i)
+    {
+        m_param_values[i] = m_apvts.getRawParameterValue(ParamIDs::all[i]->toString());
+        jassert(m_param_values[i] != nullptr);
+        // NaN never compares equal, so the first block hands every parameter to the engine
+        m_param_state[i] = std::numeric_limits<float>::quiet_NaN();
+    }
 }
 
 VintageGranularAudioProcessor::~VintageGranularAudioProcessor() {}
@@ -136,6 +143,7 @@ void VintageGranularAudioProcessor::changeProgramName(int index, const juce::Str
 void VintageGranularAudioProcessor::prepareToPlay(double sampleRate, int samplesPerBlock)
 {
     m_cpu_load.reset(sampleRate, samplesPerBlock);
+    m_block_timing.prepare(sampleRate);
     m_eng.setSampleRate(sampleRate);
 }
 
@@ -172,8 +180,9 @@ bool VintageGranularAudioProcessor::isBusesLayoutSupported(const BusesLayout &la
 void VintageGranularAudioProcessor::processBlock(juce::AudioBuffer<float> &buffer,
                                                  juce::MidiBuffer &midiMessages)
 {
-    juce::ignoreUnused(midiMessages);
     juce::AudioProcessLoadMeasurer::ScopedTimer measure(m_cpu_load, buffer.getNumSamples());
+    BlockTimingHistogram::ScopedTimer timeBlock(m_block_timing, buffer.getNumSamples());
+    rt_guard::ScopedRealtimeContext realtimeContext;
     juce::ScopedNoDenormals noDenormals;
     auto totalNumInputChannels = getTotalNumInputChannels();
     auto totalNumOutputChannels = getTotalNumOutputChannels();
@@ -181,45 +190,92 @@ void VintageGranularAudioProcessor::processBlock(juce::AudioBuffer<float> &buffe
     for (auto i = totalNumInputChannels; i < totalNumOutputChannels; ++i)
         buffer.clear(i, 0, buffer.getNumSamples());
 
-    auto bufs = buffer.getArrayOfWritePointers();
-    float mainvol = *m_apvts.getRawParameterValue(ParamIDs::mainVolume);
-    float gainscaler = juce::Decibels::decibelsToGain(mainvol);
-    float maindensity = *m_apvts.getRawParameterValue(ParamIDs::mainDensity);
-    m_eng.setDensityScaling(maindensity);
-    float gtranspose = *m_apvts.getRawParameterValue(ParamIDs::mainTranspose);
-    m_eng.setGlobalTranspose(gtranspose);
-    float gdur = *m_apvts.getRawParameterValue(ParamIDs::mainGrainDur);
-    m_eng.setDurationScaling(gdur);
-    int screenmode = *m_apvts.getRawParameterValue(ParamIDs::screenSelect);
-    m_eng.setScreenOrSelectMode(screenmode);
-    float selrate = *m_apvts.getRawParameterValue(ParamIDs::screenChangeRate);
-    m_eng.setAutoScreenSelectRate(selrate);
-    float dist = *m_apvts.getRawParameterValue(ParamIDs::distortionAmount);
-    m_eng.setDistortionAmount(dist);
-    float gprand0 = *m_apvts.getRawParameterValue(ParamIDs::grainPitchRandom0);
-    m_eng.setPitchRandomParameter(0, gprand0);
-    float lfo0depth = *m_apvts.getRawParameterValue(ParamIDs::pitchLFO0Amount);
-    m_eng.setLFODepth(0, lfo0depth);
-    float lfo1depth = *m_apvts.getRawParameterValue(ParamIDs::pitchLFO1Amount);
-    m_eng.setLFODepth(1, lfo1depth);
-    float minpitch = *m_apvts.getRawParameterValue(ParamIDs::globalMinPitch);
-    float maxpitch = *m_apvts.getRawParameterValue(ParamIDs::globalMaxPitch);
-    m_eng.setPitchRange(minpitch, maxpitch);
-    float envel = *m_apvts.getRawParameterValue(ParamIDs::globalEnvelopeLen);
-    m_eng.setEnvelopeLenth(envel);
+    // Changed parameters become an event list, and the block is rendered in runs between the
+    // events. The host doesn't timestamp parameter changes, so those apply at the start of the
+    // block. The engine doesn't play notes, MIDI is left out until it does, rather than
+    // splitting the block for nothing.
+    juce::ignoreUnused(midiMessages);
+    m_events.clear();
+    for (int i = 0; i < ParamIDs::NumParams; ++i)
+    {
+        const float value = m_param_values[i]->load(std::memory_order_relaxed);
+        if (value != m_param_state[i])
+            m_events.addParameter(0, i, value);
+    }
 
-    int dvsteps = *m_apvts.getRawParameterValue(ParamIDs::dejavuSteps);
-    float dvtime = *m_apvts.getRawParameterValue(ParamIDs::dejavuTime);
-    float dvpitch = *m_apvts.getRawParameterValue(ParamIDs::dejavuPitch);
-    float dvpan = *m_apvts.getRawParameterValue(ParamIDs::dejavuPan);
-    m_eng.setDejaVuParameters(dvsteps, dvtime, dvpitch, dvpan);
+    auto bufs = buffer.getArrayOfWritePointers();
+    m_events.process(
+        buffer.getNumSamples(),
+        [this, bufs](int start, int len) {
+            // an idle engine writes silence, which needs no gain
+            if (!m_eng.processBlock(bufs[0] + start, bufs[1] + start, len))
+                return;
+            juce::FloatVectorOperations::multiply(bufs[0] + start, m_gainscaler, len);
+            juce::FloatVectorOperations::multiply(bufs[1] + start, m_gainscaler, len);
+        },
+        [this](const EngineEvent &ev) {
+            if (ev.type == EngineEvent::Type::Parameter)
+                applyParameter(ev.paramIndex, ev.value);
+        });
+}
 
-    for (int i = 0; i < buffer.getNumSamples(); ++i)
+void VintageGranularAudioProcessor::applyParameter(int index, float value)
+{
+    m_param_state[index] = value;
+    const auto &p = m_param_state;
+    switch (index)
     {
-        float outframe[2];
-        m_eng.process(outframe);
-        bufs[0][i] = outframe[0] * gainscaler;
-        bufs[1][i] = outframe[1] * gainscaler;
+    case ParamIDs::MainVolume:
+        m_gainscaler = juce::Decibels::decibelsToGain(value);
+        break;
+    case ParamIDs::MainDensity:
+        m_eng.setDensityScaling(value);
+        break;
+    case ParamIDs::MainTranspose:
+        m_eng.setGlobalTranspose(value);
+        break;
+    case ParamIDs::MainGrainDur:
+        m_eng.setDurationScaling(value);
+        break;
+    case ParamIDs::ScreenSelect:
+        m_eng.setScreenOrSelectMode((int)value);
+        break;
+    case ParamIDs::ScreenChangeRate:
+        m_eng.setAutoScreenSelectRate(value);
+        break;
+    case ParamIDs::DistortionAmount:
+        m_eng.setDistortionAmount(value);
+        break;
+    case ParamIDs::GrainPitchRandom0:
+        m_eng.setPitchRandomParameter(0, value);
+        break;
+    case ParamIDs::PitchLFO0Amount:
+        m_eng.setLFODepth(0, value);
+        break;
+    case ParamIDs::PitchLFO1Amount:
+        m_eng.setLFODepth(1, value);
+        break;
+    case ParamIDs::GlobalMinPitch:
+    case ParamIDs::GlobalMaxPitch:
+        // on the first block the other end of the range may not have arrived yet
+        if (!std::isnan(p[ParamIDs::GlobalMinPitch]) && !std::isnan(p[ParamIDs::GlobalMaxPitch]))
+            m_eng.setPitchRange(p[ParamIDs::GlobalMinPitch], p[ParamIDs::GlobalMaxPitch]);
+        break;
+    case ParamIDs::GlobalEnvelopeLen:
+        m_eng.setEnvelopeLenth(value);
+        break;
+    case ParamIDs::DejavuSteps:
+    case ParamIDs::DejavuTime:
+    case ParamIDs::DejavuPitch:
+    case ParamIDs::DejavuPan:
+        if (!std::isnan(p[ParamIDs::DejavuSteps]) && !std::isnan(p[ParamIDs::DejavuTime]) &&
+            !std::isnan(p[ParamIDs::DejavuPitch]) && !std::isnan(p[ParamIDs::DejavuPan]))
+            m_eng.setDejaVuParameters((int)p[ParamIDs::DejavuSteps], p[ParamIDs::DejavuTime],
+                                      p[ParamIDs::DejavuPitch], p[ParamIDs::DejavuPan]);
+        break;
+    default:
+        jassertfalse;
+        break;
     }
 }
 
@@ -5,6 +5,9 @@
 #include "sst/basic-blocks/dsp/PanLaws.h"
 #include "choc_SingleReaderSingleWriterFIFO.h"
 #include "vintage_grain_engine.h"
+#include "../Source/EngineEvents.h"
+#include "../Source/BlockTimingHistogram.h"
+#include "../Source/RealtimeGuard.h"
 #include "foleys_gui_magic/foleys_gui_magic.h"
 
 namespace ParamIDs
@@ -27,6 +30,49 @@ static const juce::Identifier dejavuPitch{"DEJAVUPITCH"};
 static const juce::Identifier dejavuTime{"DEJAVUTIME"};
 static const juce::Identifier dejavuPan{"DEJAVUPAN"};
 
+// indices of the parameters in parameter events
+enum Index
+{
+    MainVolume,
+    MainDensity,
+    MainTranspose,
+    MainGrainDur,
+    ScreenSelect,
+    ScreenChangeRate,
+    DistortionAmount,
+    GrainPitchRandom0,
+    PitchLFO0Amount,
+    PitchLFO1Amount,
+    GlobalMinPitch,
+    GlobalMaxPitch,
+    GlobalEnvelopeLen,
+    DejavuSteps,
+    DejavuTime,
+    DejavuPitch,
+    DejavuPan,
+    NumParams
+};
+
+static const juce::Identifier *const all[NumParams] = {
+    &mainVolume,
+    &mainDensity,
+    &mainTranspose,
+    &mainGrainDur,
+    &screenSelect,
+    &screenChangeRate,
+    &distortionAmount,
+    &grainPitchRandom0,
+    &pitchLFO0Amount,
+    &pitchLFO1Amount,
+    &globalMinPitch,
+    &globalMaxPitch,
+    &globalEnvelopeLen,
+    &dejavuSteps,
+    &dejavuTime,
+    &dejavuPitch,
+    &dejavuPan,
+};
+
 } // namespace ParamIDs
 
 using ParameterLayoutType = juce::AudioProcessorValueTreeState::ParameterLayout;
@@ -71,11 +117,25 @@ class VintageGranularAudioProcessor : public foleys::MagicProcessor
     // void setStateInformation(const void *data, int sizeInBytes) override;
     XenVintageGranular m_eng{9999};
     juce::AudioProcessLoadMeasurer m_cpu_load;
+    // the distribution of the audio callback durations, for the editor and for monitoring
+    BlockTimingHistogram m_block_timing;
+    BlockTimingHistogram::Report getBlockTimingReport() const { return m_block_timing.getReport(); }
+#if XENOS_TRACE
+    // records the trace points while any instance is alive, see TraceRecorder.h
+    juce::SharedResourcePointer<trace::TraceRecorder> m_trace_recorder;
+#endif
     juce::AudioProcessorValueTreeState m_apvts;
     void initialiseBuilder(foleys::MagicGUIBuilder &builder) override;
 
   private:
     ParameterLayoutType createParameters();
+    void applyParameter(int index, float value);
+
+    // the raw parameter values, and the values last handed to the engine
+    std::array<std::atomic<float> *, ParamIDs::NumParams> m_param_values{};
+    std::array<float, ParamIDs::NumParams> m_param_state{};
+    EngineEventList m_events;
+    float m_gainscaler = 1.0f;
     //==============================================================================
     JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(VintageGranularAudioProcessor)
 };
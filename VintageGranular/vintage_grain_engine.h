@@ -9,6 +9,10 @@
 #include "sst/basic-blocks/modulators/SimpleLFO.h"
 #include "choc_SingleReaderSingleWriterFIFO.h"
 #include "dejavurandom.h"
+#include "../Source/TuningCache.h"
+#include "../Source/SRProvider.h"
+#include "../Source/TraceRecorder.h"
+#include "../Source/CycleAccounting.h"
 
 inline float softClip(float x)
 {
@@ -19,36 +23,6 @@ inline float softClip(float x)
     return x - std::pow(x, 3.0f) / 3.0f;
 }
 
-struct SRProvider
-{
-    static constexpr int BLOCK_SIZE = 32;
-    static constexpr int BLOCK_SIZE_OS = BLOCK_SIZE * 2;
-    SRProvider() { initTables(); }
-    alignas(32) float table_envrate_linear[512];
-    double samplerate = 44100.0;
-    void initTables()
-    {
-        double dsamplerate_os = samplerate * 2;
-        for (int i = 0; i < 512; ++i)
-        {
-            double k =
-                dsamplerate_os * pow(2.0, (((double)i - 256.0) / 16.0)) / (double)BLOCK_SIZE_OS;
-            table_envrate_linear[i] = (float)(1.f / k);
-        }
-    }
-    float envelope_rate_linear_nowrap(float x)
-    {
-        x *= 16.f;
-        x += 256.f;
-        int e = std::clamp<int>((int)x, 0, 0x1ff - 1);
-
-        float a = x - (float)e;
-
-        return (1 - a) * table_envrate_linear[e & 0x1ff] +
-               a * table_envrate_linear[(e + 1) & 0x1ff];
-    }
-};
-
 using PanMatrixType = sst::basic_blocks::dsp::pan_laws::panmatrix_t;
 
 class XenGrainVoice
@@ -308,6 +282,7 @@ class XenGrainStream
         float vol = juce::jmap<float>(dist(m_rng), 0.0f, 1.0f, m_min_volume, m_max_volume);
         float gain = juce::Decibels::decibelsToGain(vol);
         float pan = dist(m_pan_rng);
+        XENOS_TRACE_INSTANT("XenGrainStream grain start");
         v.startGrain(m_sr, hz, gain, m_grain_dur * m_dur_multiplier, pan, m_env_percent);
         if (m_visualization_enabled && m_grains_to_gui_fifo)
         {
@@ -351,6 +326,7 @@ class XenGrainStream
     float m_global_transpose = 0.0f;
     void processFrame(float *outframe)
     {
+        CycleStopwatch watch(m_count_cycles);
         if (!m_is_playing)
         {
             outframe[0] = 0.0f;
@@ -371,6 +347,7 @@ class XenGrainStream
             m_next_grain_time = m_phase + expdist(m_time_rng) * m_sr;
             // m_next_grain_time = m_phase + ((1.0 / m_grain_rate) * m_sr);
         }
+        watch.lap(m_cycles[SchedulingStage]);
         float voicesums[2] = {0.0f, 0.0f};
         float voiceframe[2];
         for (auto &v : m_voices)
@@ -393,11 +370,24 @@ class XenGrainStream
         }
 
         m_phase += 1.0;
+        watch.lap(m_cycles[GrainsStage]);
         float distorted0 = std::tanh(voicesums[0] * m_distortion_gain);
         float distorted1 = std::tanh(voicesums[1] * m_distortion_gain);
         outframe[0] = (1.0 - m_distortion_amount) * voicesums[0] + m_distortion_amount * distorted0;
         outframe[1] = (1.0 - m_distortion_amount) * voicesums[1] + m_distortion_amount * distorted1;
-    }
+        watch.lap(m_cycles[DistortionStage]);
+    }
+    // Where the stream's cycles go, see XenVintageGranular::getCpuStats. They're counted here
+    // while m_count_cycles is set and collected by the engine after every block.
+    enum CycleStage
+    {
+        SchedulingStage,
+        GrainsStage,
+        DistortionStage,
+        NumCycleStages
+    };
+    bool m_count_cycles = false;
+    std::array<juce::int64, NumCycleStages> m_cycles{};
     double m_phase = 0;
     double m_next_grain_time = 0;
 
@@ -415,7 +405,7 @@ class XenGrainStream
             m_distortion_gain = juce::Decibels::decibelsToGain(distortion_volume);
         }
     }
-    Tunings::Tuning *m_tuning = nullptr;
+    const Tunings::Tuning *m_tuning = nullptr;
     std::atomic<bool> m_visualization_enabled{false};
 };
 
@@ -432,12 +422,15 @@ class XenVintageGranular
     float m_screensdata[8][16][4];
 
   public:
-    std::array<XenGrainStream, 20> m_streams;
+    static constexpr int numStreams = 20;
+    std::array<XenGrainStream, numStreams> m_streams;
     VisualizerFifoType m_grains_to_gui_fifo;
     GuiToAudioFifoType m_gui_to_audio_fifo;
 
     int m_maxscreen = 0;
-    Tunings::Tuning m_tuning;
+    // shared with the other instances through the process wide cache
+    juce::SharedResourcePointer<TuningCache> m_tuning_cache;
+    TuningCache::TuningPtr m_tuning;
 
     float m_min_pitch = 24.0;
     float m_max_pitch = 115.0;
@@ -525,17 +518,23 @@ class XenVintageGranular
             // ok this is a bit tricky, we need to find a suitable pitch/key range out of the tuning
             double minhz = 20.0;
             double maxhz = 7500.0;
-            std::vector<int> foo;
-            foo.reserve(128);
+            int lowest = -1;
+            int highest = -1;
             for (int i = 0; i < 128; ++i)
             {
-                double hz = m_tuning.frequencyForMidiNote(i);
+                double hz = m_tuning->frequencyForMidiNote(i);
                 if (hz >= minhz && hz <= maxhz)
-                    foo.push_back(i);
+                {
+                    if (lowest < 0)
+                        lowest = i;
+                    highest = i;
+                }
+            }
+            if (lowest >= 0)
+            {
+                m_min_pitch = lowest;
+                m_max_pitch = highest;
             }
-            std::cout << "key range is " << foo.front() << " - " << foo.back() << "\n";
-            m_min_pitch = foo.front();
-            m_max_pitch = foo.back();
         }
     }
     XenVintageGranular(int seed)
@@ -544,12 +543,13 @@ class XenVintageGranular
         m_grains_to_gui_fifo.reset(16384);
         m_gui_to_audio_fifo.reset(1024);
         m_rng = std::mt19937(seed);
-        m_tuning = Tunings::evenDivisionOfCentsByM(1200.0, 7);
+        m_tuning = m_tuning_cache->get(Tunings::evenDivisionOfCentsByM(1200.0, 7),
+                                       Tunings::KeyboardMapping());
         updatePitchLimits();
         for (int i = 0; i < m_streams.size(); ++i)
         {
             m_streams[i].m_stream_id = i;
-            m_streams[i].m_tuning = &m_tuning;
+            m_streams[i].m_tuning = m_tuning.get();
             m_streams[i].m_use_tuning = m_use_tuning;
             m_streams[i].m_grains_to_gui_fifo = &m_grains_to_gui_fifo;
         }
@@ -600,6 +600,7 @@ class XenVintageGranular
     }
     void updateStreams(bool force = false)
     {
+        XENOS_TRACE_SCOPE("XenVintageGranular::updateStreams");
         std::uniform_int_distribution<int> screendist{0, m_maxscreen - 1};
         int screentouse = m_cur_active_screen;
         if (m_screen_select_mode == 0)
@@ -649,13 +650,16 @@ class XenVintageGranular
                             break;
                         }
                     }
+                    // counted instead of printed, this runs on the audio thread
                     if (!streamfound)
-                        std::cout << "could not find grain stream to start\n";
+                        ++m_streams_not_started;
                 }
             }
         }
     }
     int m_num_pitch_regions = 16;
+    // cells that found no free stream to play them
+    int m_streams_not_started = 0;
     void setPitchRange(float minpitch, float maxpitch)
     {
         m_min_pitch = minpitch;
@@ -717,38 +721,87 @@ class XenVintageGranular
             updateStreams(true);
         }
     }
-    void process(float *outframe)
+    // Renders numSamples stereo frames. The LFOs, the messages from the GUI and the screen
+    // changes are handled once per control block of SRProvider::BLOCK_SIZE samples. Returns
+    // false if the engine was idle for the whole block and only wrote silence.
+    bool processBlock(float *left, float *right, int numSamples)
+    {
+        const bool countCycles = m_cpu_stats.isEnabled();
+        for (auto &stream : m_streams)
+            stream.m_count_cycles = countCycles;
+        bool rendered = false;
+        m_control_blocks.process(
+            numSamples, [this]() { processControlBlock(); },
+            [&](int offset, int n) {
+                if (isIdle())
+                {
+                    juce::FloatVectorOperations::clear(left + offset, n);
+                    juce::FloatVectorOperations::clear(right + offset, n);
+                    advanceScreenPhase(n);
+                    return true;
+                }
+                for (int i = offset; i < offset + n; ++i)
+                    processFrame(left[i], right[i]);
+                rendered = true;
+                return true;
+            });
+        if (rendered && countCycles)
+        {
+            for (int i = 0; i < numStreams; ++i)
+            {
+                // the stream's cell, by which the editor shows its counts
+                m_cpu_stats.setTag(i, m_streams[i].m_screen_y * 16 + m_streams[i].m_screen_x);
+                m_cpu_stats.add(i, m_streams[i].m_cycles);
+                m_streams[i].m_cycles = {};
+            }
+            m_cpu_stats.endBlock(numSamples);
+        }
+        return rendered;
+    }
+    void process(float *outframe) { processBlock(outframe, outframe + 1, 1); }
+
+    // No stream is playing, so there are no grains either. Streams only start from the control
+    // blocks, on a screen change or a message from the GUI, which is where the engine wakes up.
+    bool isIdle() const
+    {
+        for (auto &stream : m_streams)
+            if (!stream.isAvailable())
+                return false;
+        return true;
+    }
+
+    void processControlBlock()
     {
         if (m_phase_resetted)
         {
             updateStreams();
             m_phase_resetted = false;
         }
-        if (m_lfo_update_counter == 0)
+        GuiToAudioMessage msg;
+        while (m_gui_to_audio_fifo.pop(msg))
         {
-            // is this going to happen too often with the blocksize of 32?
-            GuiToAudioMessage msg;
-            while (m_gui_to_audio_fifo.pop(msg))
-            {
-                handleGUIMessage(msg);
-            }
-            m_lfo0.process_block(2.0, 0.5, LFOType::Shape::SMOOTH_NOISE);
-            m_lfo1.process_block(3.0, 0.6, LFOType::Shape::SMOOTH_NOISE);
-            for (auto &stream : m_streams)
-            {
-                stream.m_global_transpose = m_global_transpose;
-                stream.m_pitch_mod_amount = 0.0;
-                if (stream.m_screen_x % 2 == 0)
-                    stream.m_pitch_mod_amount = m_lfodepths[0] * 6.0 * m_lfo0.outputBlock[0];
-                if (stream.m_screen_x % 2 == 1)
-                    stream.m_pitch_mod_amount = m_lfodepths[1] * 6.0 * m_lfo1.outputBlock[0];
-            }
+            handleGUIMessage(msg);
         }
-        ++m_lfo_update_counter;
-        if (m_lfo_update_counter == m_sr_provider.BLOCK_SIZE)
-            m_lfo_update_counter = 0;
-        outframe[0] = 0.0f;
-        outframe[1] = 0.0f;
+        // the LFOs only modulate the streams
+        if (isIdle())
+            return;
+        m_lfo0.process_block(2.0, 0.5, LFOType::Shape::SMOOTH_NOISE);
+        m_lfo1.process_block(3.0, 0.6, LFOType::Shape::SMOOTH_NOISE);
+        for (auto &stream : m_streams)
+        {
+            stream.m_global_transpose = m_global_transpose;
+            stream.m_pitch_mod_amount = 0.0;
+            if (stream.m_screen_x % 2 == 0)
+                stream.m_pitch_mod_amount = m_lfodepths[0] * 6.0 * m_lfo0.outputBlock[0];
+            if (stream.m_screen_x % 2 == 1)
+                stream.m_pitch_mod_amount = m_lfodepths[1] * 6.0 * m_lfo1.outputBlock[0];
+        }
+    }
+
+    void processFrame(float &outLeft, float &outRight)
+    {
+        outLeft = 0.0f;
+        outRight = 0.0f;
         float streamframe[2] = {0.0f, 0.0f};
         for (auto &stream : m_streams)
         {
@@ -756,15 +809,20 @@ class XenVintageGranular
             {
 
                 stream.processFrame(streamframe);
-                outframe[0] += streamframe[0];
-                outframe[1] += streamframe[1];
+                outLeft += streamframe[0];
+                outRight += streamframe[1];
             }
         }
+        advanceScreenPhase(1);
+    }
+    // the screen clock keeps running while idle, so the auto screen select stays in time
+    void advanceScreenPhase(int numSamples)
+    {
         double hz = 1.0 / m_screendur;
-        m_phase += 1.0 / m_sr * hz;
+        m_phase += numSamples / m_sr * hz;
         if (m_phase >= 1.0)
         {
-            m_phase -= 1.0;
+            m_phase -= std::floor(m_phase);
             m_phase_resetted = true;
         }
     }
@@ -774,8 +832,14 @@ class XenVintageGranular
     using LFOType = sst::basic_blocks::modulators::SimpleLFO<SRProvider, 32>;
     LFOType m_lfo0{&m_sr_provider};
     LFOType m_lfo1{&m_sr_provider};
-    int m_lfo_update_counter = 0;
+    SubBlockScheduler m_control_blocks;
     std::array<float, 2> m_lfodepths;
 
     void setLFODepth(int index, float val) { m_lfodepths[index] = val; }
+
+    // The cycles of the streams' grain scheduling, grain rendering and distortion, per stream,
+    // while counting is enabled
+    using CpuStats = CycleAccounting<numStreams, XenGrainStream::NumCycleStages>;
+    CpuStats &getCpuStats() { return m_cpu_stats; }
+    CpuStats m_cpu_stats;
 };